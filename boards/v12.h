@@ -0,0 +1,67 @@
+/*
+ Clockit v12 board <boards/v12.h>
+
+ SparkFun KIT-10930 with the common anode YSD-439AB4B-35 display.  Selected
+ with make BOARD=v12 (the default).
+
+ A board header names the pin of every display line, button and buzzer lead,
+ and says whether the display is common anode or common cathode.  clockit-v12.c
+ builds the glyph masks, the all-off port values and the input masks from these
+ at compile time, so a board is only its pin map.  The layout is fixed by the
+ firmware: digit commons and the colon on PORTD, the AM/PM common on PORTB,
+ segments on PORTC and PORTD, UP, DOWN, ALARM on PORTB and SNOOZE on PORTD.
+ The segment lines are given as a mask on each of the two ports, the one they
+ are not on is 0.
+
+ host/board.h builds the simulator's wiring from the same header.
+*/
+#ifndef BOARD_V12_H
+#define BOARD_V12_H
+
+#ifndef BOARD_COMMON_ANODE
+#define BOARD_COMMON_ANODE  1 //Commons on=1, segments on=0
+#endif
+
+// Commons, DIG_1-DIG_4 and COL on PORTD, AMPM on PORTB
+#define DIG_1   PORTD0
+#define DIG_2   PORTD1
+#define DIG_3   PORTD4
+#define DIG_4   PORTD6
+#define COL     PORTD3
+#define AMPM    PORTB3
+
+// Segments, mask on PORTC and on PORTD
+#define SEG_A_C     (1<<PORTC3)
+#define SEG_A_D     0
+#define SEG_B_C     (1<<PORTC5)
+#define SEG_B_D     0
+#define SEG_C_C     (1<<PORTC2)
+#define SEG_C_D     0
+#define SEG_D_C     0
+#define SEG_D_D     (1<<PORTD2)
+#define SEG_E_C     (1<<PORTC0)
+#define SEG_E_D     0
+#define SEG_F_C     (1<<PORTC1)
+#define SEG_F_D     0
+#define SEG_G_C     (1<<PORTC4)
+#define SEG_G_D     0
+#define SEG_DP_C    0
+#define SEG_DP_D    (1<<PORTD5)
+
+// Colon and AM/PM dots, on their own commons, share these segment lines
+#define SEG_COL_C   SEG_C_C
+#define SEG_COL_D   SEG_C_D
+#define SEG_AMPM_C  SEG_F_C
+#define SEG_AMPM_D  SEG_F_D
+
+// Buttons, UP, DOWN, ALARM on PORTB and SNOOZE on PORTD
+#define BUT_UP      PORTB5
+#define BUT_DOWN    PORTB4
+#define BUT_SNOOZE  PORTD7
+#define BUT_ALARM   PORTB0
+
+// Piezo, both leads on PORTB
+#define BUZZ1   PORTB1
+#define BUZZ2   PORTB2
+
+#endif
@@ -0,0 +1,14 @@
+/*
+ Clockit v12 board with a common cathode display <boards/v12cc.h>
+
+ The v12 wiring with a common cathode 4-digit display of the same pinout in
+ place of the YSD-439AB4B-35.  Selected with make BOARD=v12cc.  Only the
+ polarity differs: commons on=0, segments on=1.
+*/
+#ifndef BOARD_V12CC_H
+#define BOARD_V12CC_H
+
+#define BOARD_COMMON_ANODE  0 //Commons on=0, segments on=1
+#include "v12.h"
+
+#endif
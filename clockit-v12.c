@@ -48,19 +48,99 @@
 
  Theory of Operation:
  1) Three timers are used to generate interrupts to control the clock.
- -Timer0 is used in normal mode to create us delays.
+ -Timer0 runs free in normal mode at clk/8 (0.5us).  While a tone plays its compare A
+  interrupt (TIMER0_COMPA_vect) is the buzzer's tone synthesizer, every DDS_TICK_US.
+  With PROFILE its overflow interrupt (every 128us) counts the upper bits of a 
+  profiling timestamp.  Nothing busy-waits: timed actions are soft timers 
+  (timer_start()) counted in display frames by Timer2.
  -Timer1 is used to determine the time.  In CTC mode (WGM mode 12) the timer counts
   up to ICR1=15624 and generates a capture (TIMER1_CAPT_vect) interrupt  and then 
   clears the count on the next clk.  Thus the cycle is ICR1+1 clk cycles long.  The 
   clock frequency is 16MHz.  The pre-scaler is set 1024, so each count is 1024/16=64us.
-  Therefore, 1s/64us = 15625 = ICR1+1 counts each second. Timer1's ISR updates the 
-  time HH:MM:SS and AM/PM.
- -Timer2 is used in normal mode to update the display every 256*64us = 16.384ms.
+  Therefore, 1s/64us = 15625 = ICR1+1 counts each second.  A count per second is 
+  64ppm, so crystal error is trimmed in finer steps: the trim (clock_trim, 0.1ppm, 
+  kept in EEPROM and set in calibration mode) is a whole number of counts in ICR1 
+  plus a fraction that adds up every second, and each time it carries that second 
+  is one count longer.  ICR1 is written half way through the second by the compare 
+  B interrupt (TIMER1_COMPB_vect, OCR1B).  Timer1's capture ISR updates the 
+  time.  Times of day (time, alarm, snooze) are kept as seconds since midnight 
+  (tod_t) and all carry/borrow and 12-hour AM/PM handling is done by the tod_*() 
+  routines.  At midnight the day of the week (time_wday) moves on.  Main gets a
+  consistent copy of the time with time_get(), which re-reads if the ISR bumped
+  time_gen meanwhile, and changes it with time_adjust().
+  The capture ISR also counts the seconds since power-up (uptime_sec), never set
+  or adjusted.  With TCNT1 as the phase within the second, uptime_get() is a
+  monotonic timestamp of 64us resolution.
+ -Timer2 is the display multiplex engine.  In CTC mode (WGM mode 2) with clk/32 
+  (2us per count) it generates a compare A interrupt (TIMER2_COMPA_vect) every 
+  DISPLAY_SLOT_US.  Each interrupt lights the next of DISPLAY_SLOTS slots (4 digits, 
+  colon, alarm dot, AM/PM dot) and returns.  Compare B (TIMER2_COMPB_vect) blanks 
+  the display after the slot's on-time (at most DISPLAY_ON_US).  The port values 
+  and on-time of each slot come from a double-buffered framebuffer that 
+  display_update() rebuilds from the glyph table in flash only when the time, 
+  alarm or display mode changes.
+ -The buzzer plays melodies of notes from flash.  A phase accumulator in 
+  TIMER0_COMPA_vect makes the tone (direct digital synthesis), its pulse width is 
+  the volume, and the display frame steps the notes and ramps the volume up.  
+  buzzer_start() starts a melody and returns at once.
  2) A form of pulse-width-modulation PWM is used to drive the display without the 
  need for limiting resistors.  However, it is possible to burn out the display if 
- the elements are left on too long.  (See display_time function for more details).
- 3) The alarm condition and the three buttons are polled using the function 
- check_alarm and check_button in main.
+ the elements are left on too long.  The on-time of each slot is OCR2B and is 
+ always ended by the compare B interrupt, a slot lit too late to end within the 
+ slot is left dark instead.  (See TIMER2_COMPA_vect for details).
+ Every frame has the same 7 slots, dark ones included, so the duty cycle of each 
+ digit only depends on the brightness: DISPLAY_LEVELS on-times spaced for the eye, 
+ picked with a tap of UP or DOWN and kept in EEPROM.  Without resistors a segment
+ gets less current the more segments share its anode, so each glyph has its own 
+ on-time (glyph_on_table[]) that makes a 1 as bright as an 8.
+ 3) The alarm condition and the three buttons are checked using the function 
+ check_alarm and check_button in main.  The buttons and the alarm switch are 
+ debounced together by the multiplex engine once a frame (input_tick()), which 
+ posts press, release, hold and auto-repeat events; nothing waits on a button.
+ The set modes are a state machine (ui_mode/ui_phase) that check_buttons() steps
+ once per pass of the main loop, so the alarm keeps working in every mode.
+ Between events main sleeps (SLEEP_MODE_IDLE).  It is woken by the second tick 
+ (EV_TICK), an input event (EV_INPUT), a new frame swapped in by the display 
+ (EV_FRAME) or a console line (EV_CONSOLE).
+ Timer1 and Timer2 need the I/O clock, so idle is the deepest mode that keeps time; 
+ the unused ADC, comparator, TWI, SPI and USART are powered down instead.  Every 
+ display slot samples whether main was awake or asleep (cpu_awake_slots).
+ 4) Built with PROFILE, the ISRs and the main loop time themselves with Timer0 and 
+ keep min/max/sum in RAM (prof_*), and the time main spends asleep gives the CPU 
+ load of the last second.  Holding UP, then SNOOZE, shows them on the display (see 
+ diag_value()).
+ 5) Built with CONSOLE, USART0 runs a serial console at BAUD 8N1 for reading and 
+ setting the time and alarm (see check_console()).  USART_RX_vect and 
+ USART_UDRE_vect only move bytes between the UART and two ring buffers, commands 
+ are run by main.  RXD/TXD are the DIG1/DIG2 anode pins, so the hours are not 
+ shown in a CONSOLE build.  Lines starting with '$' or 'T' set the clock instead: 
+ NMEA $--RMC/$--ZDA sentences from a GPS or a "T hh:mm:ss" from a PC are parsed
+ a byte at a time by USART_RX_vect (sync_rx()) and TIMER1_CAPT_vect starts the 
+ next second on them, Timer1 phase and all (see check_sync()).
+ 6) The alarms, the snooze, the crystal trim and the time every 10 minutes are saved
+ in a wear-leveled ring of CRC checked records in EEPROM and restored at power up 
+ (see check_persist()).  Changes are saved once they have settled for a few 
+ seconds, and EE_READY_vect writes them in the background.  The time that comes 
+ back is the last checkpoint, so it blinks until it is set or synced (time_unsure).
+ 7) There are ALARMS alarms, each with the days of the week it goes off on and 
+ either repeating or one-shot.  ALARM SET edits the first one, the console all 
+ of them.  alarm_schedule() works out which one is due next (alarm_due) when an 
+ alarm, the snooze or the time is changed and when one went off, and the uptime 
+ second it comes due at (alarm_due_up).  On each second tick check_alarm() only 
+ compares the uptime with that, so an alarm that came due while main was busy 
+ still goes off, and how late it was is counted (alarm_late_ms).
+ 8) A reset other than power-up (watchdog, brown-out, the reset pin) is a warm 
+ restart: a snapshot of the state kept in .noinit RAM, checked by a magic number
+ and a CRC, brings back the time to about a millisecond, the alarms and the snooze,
+ with no beep or segment test (see warm_start()).  Built with WATCHDOG, the main 
+ loop feeds a 500ms watchdog, so a hang is over in under a second.
+ 9) Built with TRACE, a ring of the last TRACE_SIZE events in RAM keeps a 
+ history to go by when a unit misbehaves: second ticks, alarms, snoozes, set 
+ modes, ISR overruns and resets, each stamped with TCNT1.  Any ISR or main 
+ records one in a few cycles (trace()), and the ring is kept through a warm 
+ restart, so it shows what led up to a watchdog reset.  The display steps 
+ through it on a unit that is still a clock (hold UP, DOWN and SNOOZE, see 
+ trace_page()), and with CONSOLE the console reads it out (see trace_dump()).
 
  Hardware:
  AVRmega328P with 7-segment 4-digit display [YSD-439AB4B-35]
@@ -140,83 +220,680 @@
 
 #define NORMAL_TIME
 //#define DEBUG_TIME
+//#define PROFILE //ISR profiling and the diagnostics display mode, or make PROFILE=1
+//#define CONSOLE //Serial console on RXD/TXD instead of DIG1/DIG2, or make CONSOLE=1
+//#define TRACE //Event trace ring read on the display or the console, or make TRACE=1
 
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <avr/eeprom.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+#include <avr/wdt.h>
+#include "hal.h"
 
 #define sbi(port, pin)   ((port) |= (uint8_t)(1 << pin))
 #define cbi(port, pin)   ((port) &= (uint8_t)~(1 << pin))
 
 #define FOSC 16000000 //16MHz internal osc
 //#define FOSC 1000000 //1MHz internal osc
-//#define BAUD 9600
-//#define MYUBRR (((((FOSC * 10) / (16L * BAUD)) + 5) / 10) - 1)
+#define BAUD 9600
+#define MYUBRR (((((FOSC * 10) / (16L * BAUD)) + 5) / 10) - 1)
 
 #define STATUS_LED  5 //PORTB
 
 #define TRUE    1
 #define FALSE   0
 
-// Common anodes
-#define DIG_1   PORTD0
-#define DIG_2   PORTD1
-#define DIG_3   PORTD4
-#define DIG_4   PORTD6
-#define COL     PORTD3
-#define AMPM    PORTB3
-
-// Cathodes
-#define SEG_A   PORTC3
-#define SEG_B   PORTC5
-#define SEG_C   PORTC2
-#define SEG_D   PORTD2
-#define SEG_E   PORTC0
-#define SEG_F   PORTC1
-
-#define DP      PORTD5
-#define COL_C   PORTC2
-#define AMPM_C  PORTC1
-
-// Buttons
-#define BUT_UP      PORTB5
-#define BUT_DOWN    PORTB4
-#define BUT_SNOOZE  PORTD7
-#define BUT_ALARM   PORTB0
-
-#define BUZZ1   PORTB1
-#define BUZZ2   PORTB2
+// Pin map of the board, make BOARD=... (boards/v12.h is the default)
+#ifndef BOARD_HEADER
+#define BOARD_HEADER "boards/v12.h"
+#endif
+#include BOARD_HEADER
 
 #define AM  1
 #define PM  2
 
+// Inputs, one byte with each at its pin's bit: UP, DOWN, ALARM from PINB, SNOOZE from PIND
+#define INPUT_PINB      ((1<<BUT_UP)|(1<<BUT_DOWN)|(1<<BUT_ALARM))
+#define INPUT_PIND      (1<<BUT_SNOOZE)
+#define INPUT_BUTTONS   ((1<<BUT_UP)|(1<<BUT_DOWN)|(1<<BUT_SNOOZE)) //Low when pressed
+#if (INPUT_PINB & INPUT_PIND) != 0
+#error "Inputs on PORTB and PORTD have to be on different bits"
+#endif
+#if (INPUT_PINB & ((1<<AMPM)|(1<<BUZZ1)|(1<<BUZZ2))) != 0
+#error "Inputs on PORTB share a pin with the AM/PM common or the buzzer"
+#endif
+
+// Debouncer timing, run once a display frame (DISPLAY_SLOTS * DISPLAY_SLOT_US = 2.1ms)
+#define INPUT_HOLD_MS           1000 //Buttons held together this long: hold event (set modes)
+#define INPUT_REPEAT_START_MS   500  //A held button repeats after
+#define INPUT_REPEAT_MS         100  //and then every
+
+// User interface modes (ui_mode), and where in a mode we are (ui_phase)
+#define UI_TIME         0 //The time, SNOOZE shows the alarm while held
+#define UI_CLOCK_SET    1 //Hold UP and DOWN
+#define UI_ALARM_SET    2 //Hold SNOOZE
+#define UI_CALIBRATE    3 //Hold DOWN, then SNOOZE
+#define UI_DIAGNOSTICS  4 //Hold UP, then SNOOZE (PROFILE)
+#define UI_TRACE        5 //Hold UP, DOWN and SNOOZE (TRACE)
+
+#define UI_HELD         0 //The buttons that got us here are still down
+#define UI_EDIT         1 //UP and DOWN step the value, SNOOZE is done
+#define UI_DONE         2 //The value blinks, then back to UI_TIME
+
+#define UI_BLINK_MS     250 //Blink half period
+
+#define FRAME_TICKS(ms) ((uint16_t)((ms) * 1000UL / (DISPLAY_SLOTS * DISPLAY_SLOT_US)))
+#define FRAME_MS(ticks) ((uint16_t)((ticks) * (uint32_t)(DISPLAY_SLOTS * DISPLAY_SLOT_US) / 1000))
+
+// Soft timers, see timer_start()
+#define TIMER_UI        0 //UI blink, ui_blink()
+#define TIMER_POWER_UP  1 //Deadline: 88:88 while the power up beep plays
+#define POWER_UP_MS     75 //Length of power_up_melody
+#ifdef WATCHDOG
+#define TIMERS          3 //One for each user
+#define TIMER_WATCHDOG  2 //Periodic, wakes main up to feed the watchdog
+#define WATCHDOG_FEED_MS    200 //Well inside WDTO_500MS
+#else
+#define TIMERS          2 //One for each user
+#endif
+
+typedef struct
+{
+    uint16_t due;     //timer_ticks it runs out at
+    uint16_t period;  //Frames to the next time, 0 for a one-shot
+    void (*fn)(void); //Called by check_timers(), NULL for a plain deadline
+    uint8_t on;
+} soft_timer_t;
+
+// Timer1: 15625 counts of 64us per second, ICR1+1
+#define TIMER1_TOP  15624
+
+// Crystal trim in 0.1ppm, + when the crystal runs fast (the clock gains time)
+#define TRIM_STEP   640 //Trim of one Timer1 count per second (64ppm)
+#define TRIM_MAX    999 //+-99.9ppm, fits the display
+
+// Time of day: seconds since midnight, 0..TOD_DAY-1
+typedef uint32_t tod_t;
+
+#define TOD_MINUTE  60L
+#define TOD_HOUR    3600L
+#define TOD_DAY     86400L
+#define TOD_NEVER   0xFFFFFFFFUL //Never equal to a time of day
+
+// Alarm schedule
+#define ALARMS      4    //Alarms, alarms[0] is the one ALARM SET edits
+#define ALARM_DAYS  0x7F //alarm_t.days: bit n is day n of the week, 0 is Sunday.  None is off
+#define ALARM_ONCE  0x80 //alarm_t.days: one-shot, off once it came due
+#define WEEK_DAYS   7
+
+typedef struct
+{
+    tod_t time;   //Time of day, on the minute
+    uint8_t days; //ALARM_DAYS | ALARM_ONCE
+} alarm_t;
+
+// EEPROM: a ring of persist_t records, the newest is the state at power up
+typedef struct
+{
+    uint16_t alarm[ALARMS]; //alarms[].time, minute of the day
+    uint8_t days[ALARMS];   //alarms[].days
+    uint16_t time;   //Time checkpoint, minute of the day
+    uint16_t snooze; //Minute of the day the snooze ends, PERSIST_NO_SNOOZE
+    int16_t trim;    //clock_trim
+    uint8_t wday;    //time_wday
+    uint8_t bright;  //display_level
+    int16_t zone;    //sync_zone
+    uint8_t seq;     //Record number, one more than the record before
+    uint8_t crc;     //CRC-8 of the bytes before it
+} persist_t;
+
+#define PERSIST_RECORDS     42  //42 * 24 = 1008 of the 1024 bytes
+#define PERSIST_CHECKPOINT  10  //Minutes between time checkpoints
+#define PERSIST_SETTLE      3   //Seconds a change has to stand before it is written
+#define PERSIST_NO_SNOOZE   0xFFFF
+
+// Warm restart: a snapshot of the state in RAM that a reset leaves alone
+typedef struct
+{
+    uint8_t magic;      //WARM_MAGIC
+    uint32_t uptime;    //uptime_sec the snapshot was taken in
+    tod_t time;         //time_now then
+    uint8_t wday;       //time_wday
+    alarm_t alarms[ALARMS];
+    uint8_t snooze;     //snooze
+    tod_t snooze_time;  //time_snooze
+    uint8_t going;      //alarm_going
+    tod_t due;          //alarm_due
+    uint8_t due_day;    //alarm_due_day
+    uint32_t due_up;    //alarm_due_up
+    uint8_t resched;    //alarm_resched
+    int16_t trim;       //clock_trim
+    uint8_t bright;     //display_level
+    uint8_t unsure;     //time_unsure
+    uint8_t crc;        //CRC-8 of the bytes before it
+} warm_t;
+
+// Event trace (TRACE): a ring of trace_t in RAM a reset leaves alone, see trace()
+typedef struct
+{
+    uint8_t ev;     //TR_*
+    uint8_t arg;    //What it is about, by event
+    uint16_t phase; //TCNT1, 64us into the second
+} trace_t;
+
+#define TRACE_SIZE  64  //Events in the ring, a power of 2 up to 128
+#define TRACE_LINE  8   //Events a console reply
+#define TRACE_MAGIC 0x7E
+#define TRACE_EMPTY 0xFF //ev of an entry not written since power-up
+#define TR_RESET    0 //Reset, arg = MCUSR
+#define TR_TICK     1 //Second tick, arg = uptime_sec & 0xFF.  Stamped ICR1, the count it runs in
+#define TR_ALARM    2 //Alarm or snooze came due, arg = 1 sounding, + 2 a snooze
+#define TR_SNOOZE   3 //Snooze, arg = 0 hit, 1 put off by the alarm switch
+#define TR_MODE_IN  4 //Set mode entered, arg = ui_mode
+#define TR_MODE_OUT 5 //Set mode left, arg = ui_mode
+#define TR_OVERRUN  6 //An ISR ran late, arg = TR_OVR_*
+#define TR_LETTERS  "RTASMmO" //Of each event on the console
+#define TR_OVR_SLOT 0 //TIMER2_COMPA_vect came too late for the slot's on-time, left dark
+#define TR_OVR_RX   1 //USART_RX_vect lost a byte
+#define TR_OVR_TICK 2 //Main missed a second tick
+
+#define WARM_MAGIC  0xC1
+#define WARM_STALE  5 //Seconds the snapshot may be older than the frame stamp
+#define WARM_LATE   ((DISPLAY_SLOTS * DISPLAY_SLOT_US / 2 + 100) / 64) //Timer1 counts from the frame stamp
+                    //to the restart: half a frame on average, the reset start-up ~100us
+
+// Display multiplex engine (Timer2, clk/32 => 2us per count)
+#define DISPLAY_TICK_US     2
+#define DISPLAY_SLOT_US     300 //One slot lit per interrupt: 7 slots * 300us = 2.1ms frame (~476Hz)
+                                //Also the buzzer half period: 1/600us = 1.67kHz like the old siren()
+#define DISPLAY_ON_US       60  //Brightest LED on-time per slot.  No limiting resistors, keep this short!
+#define DISPLAY_DIM_US      16  //On-time of an 8 at the dimmest level, see glyph_on_table[]
+#define DISPLAY_SLOTS       7   //DIG1, DIG2, DIG3, DIG4, COL, alarm dot, AM/PM dot
+#define DISPLAY_ON_MIN      2   //Shortest on-time in Timer2 counts (4us).  It counts from when the slot is lit, so 
+                                //interrupt latency moves the slot, not its on-time (see TIMER2_COMPA_vect)
+#define DISPLAY_LEVELS      6   //Brightness levels, see glyph_on_table[]
+#define DISPLAY_LEDS_MAX    7   //LEDs lit by the busiest glyph, an 8
+#define DISPLAY_LEDS_MIN    1   //LEDs lit by the quietest glyphs, the dots and the minus
+
+#define DISPLAY_SLOT_TICKS  (DISPLAY_SLOT_US / DISPLAY_TICK_US)
+#define DISPLAY_ON_TICKS    (DISPLAY_ON_US / DISPLAY_TICK_US)
+#define DISPLAY_DIM_TICKS   (DISPLAY_DIM_US / DISPLAY_TICK_US)
+
+#if DISPLAY_SLOT_TICKS > 256 || DISPLAY_ON_TICKS >= DISPLAY_SLOT_TICKS
+#error "DISPLAY_ON_US must be shorter than DISPLAY_SLOT_US, and DISPLAY_SLOT_US at most 512us"
+#endif
+
+// What the multiplex engine shows
+#define SHOW_TIME   0
+#define SHOW_ALARM  1
+#define SHOW_BLANK  2
+#define SHOW_TEST   3 //Segment test 88:88
+#define SHOW_NUMBER 4 //display_value
+
+#define BLANK   0xFF //Glyph that lights nothing
+#define MINUS   13   //Glyph of a minus sign
+
+// Events that wake up the main loop
+#define EV_TICK     (1<<0) //Timer1 second tick
+#define EV_INPUT    (1<<1) //Button or alarm switch changed
+#define EV_FRAME    (1<<2) //Display swapped in a new frame
+#define EV_CONSOLE  (1<<3) //Console line came in
+#define EV_TIMER    (1<<4) //A soft timer ran out
+
+#define SLOTS_PER_SECOND    (1000000UL / DISPLAY_SLOT_US)
+
+// Buzzer tone synthesizer (Timer0 compare A every DDS_TICK_US, 64 counts of 0.5us)
+#define DDS_TICK_US     32
+#define DDS_TICKS       (DDS_TICK_US * 2)
+#define DDS_RATE        (1000000UL / DDS_TICK_US) //Samples a second
+#define DDS_STEP(hz)    ((uint16_t)((hz) * 65536UL / DDS_RATE)) //Phase step of a tone
+#define DDS_DUTY_MAX    128 //Pulse width out of 256 for the loudest, a square wave
+#define DDS_DUTY_MIN    ((DDS_STEP(4186) >> 8) + 1) //Quietest, where a volume ramp starts: a sample of C8,
+                                //the highest note.  A shorter pulse falls between samples in some turns
+
+// Melody notes: a note of notes_step[] (NOTE_REST is quiet) and its length in frames
+#define NOTE_MS(ms)     ((uint8_t)FRAME_TICKS(ms)) //535ms at most
+#define NOTE_REST   0
+#define NOTE_C6     1
+#define NOTE_CS6    2
+#define NOTE_D6     3
+#define NOTE_DS6    4
+#define NOTE_E6     5
+#define NOTE_F6     6
+#define NOTE_FS6    7
+#define NOTE_G6     8
+#define NOTE_GS6    9
+#define NOTE_A6     10
+#define NOTE_AS6    11
+#define NOTE_B6     12
+#define NOTE_C7     13
+#define NOTE_CS7    14
+#define NOTE_D7     15
+#define NOTE_DS7    16
+#define NOTE_E7     17
+#define NOTE_F7     18
+#define NOTE_FS7    19
+#define NOTE_G7     20
+#define NOTE_GS7    21
+#define NOTE_A7     22
+#define NOTE_AS7    23
+#define NOTE_B7     24
+#define NOTE_C8     25
+
+typedef struct
+{
+    uint8_t note; //NOTE_*
+    uint8_t len;  //NOTE_MS(), 0 ends the melody
+} note_t;
+
+#define ALARM_RAMP_MS   30000 //The alarm gets from DDS_DUTY_MIN to DDS_DUTY_MAX in this long
+#define ALARM_RAMP      FRAME_TICKS(ALARM_RAMP_MS / (DDS_DUTY_MAX - DDS_DUTY_MIN)) //Frames a volume step
+
+// Profiling (PROFILE): Timer0 counts of 0.5us, 24-bit timestamps wrap after 8.4s
+#define PROF_COUNTS_PER_SECOND  (FOSC / 8)
+#define PROF_MASK               0xFFFFFFUL
+#define PROF_PAGES              8
+
+// Serial console (CONSOLE)
+#define CONSOLE_RX_SIZE     128 //Ring buffers, powers of 2.  RX holds a whole line, main takes it at the end
+#define CONSOLE_TX_SIZE     128
+#define CONSOLE_LINE        120 //Longest command line: time, day, all ALARMS alarms, brightness, trim
+                                //and UTC offset fit with room to spare (~105 characters)
+
+#if CONSOLE_LINE + 2 > CONSOLE_RX_SIZE - 1
+#error "A CONSOLE_LINE line and its \r\n have to fit in the RX ring"
+#endif
+
+// Time sync lines on the console (CONSOLE), see sync_rx()
+#define SYNC_CHAR_COUNTS    ((10 * 1000000UL / BAUD + 32) / 64) //Start bit of a byte to its interrupt, Timer1 counts
+#define SYNC_STALE          3   //Seconds from a line to the second it is applied in, more is dropped
+#define SYNC_ZONE_MAX       (14 * 60) //UTC offset of NMEA times, minutes
+#define SYNC_START      0 //Parser state: the next byte starts a line
+#define SYNC_CONSOLE    1 //A command line, it goes into the RX ring
+#define SYNC_ID         2 //$ttsss, the talker and the sentence
+#define SYNC_FIELDS     3 //The fields up to the *
+#define SYNC_SUM        4 //The 2 hex digits of the checksum
+#define SYNC_PLAIN      5 //T hh:mm:ss
+#define SYNC_SKIP       6 //Not one we use, or garbled: to the end of the line
+#define SYNC_RMC    1 //Sentences, sync_kind
+#define SYNC_ZDA    2
+#define SYNC_T      3
+#define SYNC_D_TIME     0  //sync_d[]: hhmmss
+#define SYNC_D_CS       6  //Hundredths of the second
+#define SYNC_D_DATE     8  //ddmmyy
+#define SYNC_DIGITS     14
+#define SYNC_GOT_TIME   (1<<0) //sync_got
+#define SYNC_GOT_DATE   (1<<1)
+#define SYNC_GOT_FIX    (1<<2) //$--RMC status A
+
+// Segment and common lines of the board on each port
+#define DISPLAY_SEGS_C      (SEG_A_C|SEG_B_C|SEG_C_C|SEG_D_C|SEG_E_C|SEG_F_C|SEG_G_C|SEG_DP_C)
+#define DISPLAY_SEGS_D      (SEG_A_D|SEG_B_D|SEG_C_D|SEG_D_D|SEG_E_D|SEG_F_D|SEG_G_D|SEG_DP_D)
+#define DISPLAY_COMS_D      ((1<<DIG_1)|(1<<DIG_2)|(1<<DIG_3)|(1<<DIG_4)|(1<<COL))
+#if (DISPLAY_SEGS_D & (DISPLAY_COMS_D | INPUT_PIND)) != 0
+#error "Segments on PORTD share a pin with a common or the snooze button"
+#endif
+
+// Port values with every common and segment off (the inputs keep their pull-ups), 
+// and the port value with a segment or a common turned on
+#if BOARD_COMMON_ANODE
+#define DISPLAY_PORTB_OFF   INPUT_PINB                  //AMPM anode off=0
+#define DISPLAY_PORTC_OFF   DISPLAY_SEGS_C              //Cathodes off=1
+#define DISPLAY_PORTD_OFF   (DISPLAY_SEGS_D|INPUT_PIND) //Cathodes off=1, anodes off=0
+#define DISPLAY_SEG_ON(port, segs)  ((uint8_t)((port) & ~(segs)))
+#define DISPLAY_COM_ON(port, coms)  ((uint8_t)((port) | (coms)))
+#define DISPLAY_AMPM_ON()   sbi(PORTB, AMPM)
+#define DISPLAY_AMPM_OFF()  cbi(PORTB, AMPM)
+#else
+#define DISPLAY_PORTB_OFF   (INPUT_PINB|(1<<AMPM))      //AMPM cathode off=1
+#define DISPLAY_PORTC_OFF   0                           //Anodes off=0
+#define DISPLAY_PORTD_OFF   (DISPLAY_COMS_D|INPUT_PIND) //Anodes off=0, cathodes off=1
+#define DISPLAY_SEG_ON(port, segs)  ((uint8_t)((port) | (segs)))
+#define DISPLAY_COM_ON(port, coms)  ((uint8_t)((port) & ~(coms)))
+#define DISPLAY_AMPM_ON()   cbi(PORTB, AMPM)
+#define DISPLAY_AMPM_OFF()  sbi(PORTB, AMPM)
+#endif
+
 //Declare functions
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 void ioinit (void);
-void delay_ms(uint16_t x); // general purpose delay
-void delay_us(uint16_t x);
-
-void siren(int duration);
-void display_number(uint8_t number, uint8_t digit);
-void display_time(uint16_t time_on);
-void display_alarm_time(uint16_t time_on);
+tod_t tod_add(tod_t t, int32_t delta);
+tod_t tod_until(tod_t from, tod_t to);
+tod_t tod_minute(tod_t t);
+tod_t tod_make(uint8_t hours, uint8_t minutes, uint8_t seconds, uint8_t ampm);
+void tod_split(tod_t t, uint8_t *hours, uint8_t *minutes, uint8_t *seconds, uint8_t *ampm);
+tod_t time_get(void);
+tod_t time_get_day(uint8_t *wday);
+tod_t time_get_tick(uint8_t *wday, uint32_t *up);
+uint32_t uptime_get(uint16_t *phase);
+void time_adjust(int32_t delta);
+void time_set(tod_t t);
+void time_set_wday(uint8_t wday);
+void alarm_set(uint8_t n, tod_t t, uint8_t days);
+void alarm_schedule(tod_t now, uint8_t wday, uint32_t up);
+void trim_set(int16_t trim);
+uint8_t persist_crc(const persist_t *r);
+void persist_get(persist_t *r, tod_t now);
+uint8_t persist_load(void);
+void check_persist(void);
+uint8_t warm_crc(const warm_t *w);
+uint8_t warm_start(uint8_t flags);
+void warm_restore(void);
+void check_warm(void);
+void timer_start(uint8_t id, uint16_t ms, uint16_t period_ms, void (*fn)(void));
+void timer_stop(uint8_t id);
+uint8_t timer_running(uint8_t id);
+void timer_arm(void);
+void check_timers(void);
+
+void buzzer_start(const note_t *melody, uint8_t repeat, uint8_t ramp);
+void buzz_note(void);
+void buzzer_stop(void);
+uint8_t display_update(void);
 void clear_display(void);
+void display_level_set(uint8_t level);
 void check_buttons(void);
+uint8_t input_take(volatile uint8_t *ev, uint8_t mask);
+void input_flush(void);
+void ui_enter(uint8_t mode);
+void ui_blink(void);
+void ui_adjust(uint8_t up, uint8_t repeat);
+void ui_display(void);
+uint8_t ramp_next(uint8_t *sling_shot, uint8_t *step, uint8_t repeat, uint8_t max);
 void check_alarm(void);
+void check_alarm_switch(void);
+uint8_t wait_for_event(void);
+#ifdef PROFILE
+uint32_t prof_now(void);
+uint16_t diag_value(uint8_t page);
+#endif
+#ifdef CONSOLE
+void console_init(void);
+void console_putc(char c);
+void console_put_number(uint32_t n);
+void console_put_tod(tod_t t);
+tod_t console_get_tod(const char *s);
+uint8_t console_get_int(const char *s, int16_t *v);
+uint8_t console_get_days(const char *s);
+void console_command(char *cmd);
+void check_sync(void);
+void check_console(void);
+#endif
+#ifdef TRACE
+void trace_start(uint8_t flags);
+uint8_t trace_page(uint8_t page, int16_t *value);
+#ifdef CONSOLE
+void trace_dump(uint8_t seq, uint8_t all);
+#endif
+#endif
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 
 //Declare global variables
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
-uint8_t hours, minutes, seconds, ampm, flip;
-uint8_t hours_alarm, minutes_alarm, seconds_alarm, ampm_alarm, flip_alarm;
-uint8_t hours_alarm_snooze, minutes_alarm_snooze, seconds_alarm_snooze, ampm_alarm_snooze;//, flip_alarm;
+volatile tod_t time_now; //Current time, written by TIMER1_CAPT_vect.  Read it with time_get()
+volatile uint8_t time_gen; //Bumped every time time_now changes
+volatile uint8_t time_wday; //Day of the week, 0 is Sunday, moved on at midnight by TIMER1_CAPT_vect
+uint8_t time_unsure; //The time is the default or an EEPROM checkpoint, it blinks until it is set
+volatile uint32_t uptime_sec; //Seconds since power-up, TIMER1_CAPT_vect.  Read it with uptime_get()
+tod_t time_snooze; //Alarm goes off again here after a snooze
+
+alarm_t alarms[ALARMS]; //Change them with alarm_set()
+tod_t alarm_due = TOD_NEVER; //Next alarm or snooze, on day alarm_due_day.  TOD_NEVER if there is none
+uint8_t alarm_due_day;
+uint32_t alarm_due_up; //uptime_sec it comes due in
+uint8_t alarm_resched; //The alarms, the snooze or the time changed, alarm_schedule() again
 
 uint8_t alarm_going;
+uint8_t alarm_sounding;
 uint8_t snooze;
+
+//Alarms and snoozes that came due, and how late check_alarm() saw them
+uint16_t alarm_fired;
+uint16_t alarm_late_ms; //The last one, from the start of its second
+uint16_t alarm_late_max; //The worst
+
+//Crystal trim, applied by TIMER1_COMPB_vect.  Change it with trim_set()
+int16_t clock_trim; //0.1ppm
+uint16_t trim_top; //ICR1 of a normal second
+uint16_t trim_frac; //Fraction of a count per second, in 0.1ppm (0..TRIM_STEP-1)
+uint16_t trim_acc; //Fraction added up so far
+
+//Persistence, see check_persist()
+persist_t persist_rec; //Record last written, EE_READY_vect is writing it while EERIE is on
+uint8_t persist_slot; //Ring slot of persist_rec
+volatile uint8_t persist_left; //Bytes EE_READY_vect has still to write
+persist_t persist_want; //State check_persist() saw last
+tod_t persist_since; //When it changed
+uint8_t persist_time_moved; //time_set() or time_adjust() ran, save the time
+
+int16_t sync_zone; //UTC offset of NMEA time sync lines, minutes (CONSOLE)
+
+//Warm restart, see warm_start().  Not cleared by the C start-up
+warm_t warm HAL_NOINIT; //Snapshot of the state, kept by check_warm()
+volatile uint32_t warm_sec HAL_NOINIT; //uptime_sec and TCNT1 at the last frame, TIMER2_COMPB_vect
+volatile uint16_t warm_phase HAL_NOINIT;
+
+//Debounced inputs, kept by the multiplex engine.  A bit per input at its pin's bit
+volatile uint8_t input_state; //1 = button down, alarm switch on
+uint8_t input_ct0 = 0xFF, input_ct1 = 0xFF; //Vertical counters, 2 bits per input
+uint16_t input_hold_count; //Frames to the hold event
+uint8_t input_repeat_count; //Frames to the next repeat
+//Events, a bit per input, set by the ISR and taken with input_take()
+volatile uint8_t input_press; //Went down (alarm switch: on)
+volatile uint8_t input_release; //Came up (alarm switch: off)
+volatile uint8_t input_hold; //The buttons held together for INPUT_HOLD_MS
+volatile uint8_t input_repeat; //Buttons still held, every INPUT_REPEAT_MS
+
+//User interface, run a step at a time by check_buttons()
+uint8_t ui_mode; //UI_TIME, UI_CLOCK_SET, ...
+uint8_t ui_phase; //UI_HELD, UI_EDIT, UI_DONE
+uint8_t ui_blank; //Blink phase: display off
+uint8_t ui_blinks; //Blink half periods left in UI_DONE
+uint8_t ui_sling_shot, ui_step; //Ramp of a held button, see ramp_next()
+uint8_t ui_tap; //UP or DOWN pressed on its own in UI_TIME, brightness if let go before it is held
+#if defined(PROFILE) || defined(TRACE)
+uint8_t ui_page; //Diagnostics or trace page
+#endif
+#ifdef TRACE
+uint8_t ui_trace_end, ui_trace_len; //trace_count and the events in the ring when UI_TRACE was entered
+#endif
+
+//Tone synthesizer, TIMER0_COMPA_vect
+uint16_t dds_phase; //Phase accumulator, a turn is 65536
+volatile uint16_t dds_step; //Phase step a sample, the tone
+volatile uint8_t dds_duty; //Pulse width, the volume.  0 is quiet
+
+//Melody player, run by the multiplex engine once a frame
+volatile uint8_t buzz_count; //Frames left of this note, 0 = quiet
+uint8_t buzz_repeat; //Start over at the end of the melody
+uint8_t buzz_volume; //dds_duty of the notes
+uint8_t buzz_ramp, buzz_ramp_count; //Frames a volume step, 0 for none
+const note_t *buzz_melody; //Melody in flash
+const note_t *buzz_next; //Next note
+
+//Phase step of each note, C6 (1047Hz) to C8 (4186Hz) in semitones
+const uint16_t notes_step[] PROGMEM =
+{
+    0,
+    DDS_STEP(1047), DDS_STEP(1109), DDS_STEP(1175), DDS_STEP(1245), DDS_STEP(1319), DDS_STEP(1397),
+    DDS_STEP(1480), DDS_STEP(1568), DDS_STEP(1661), DDS_STEP(1760), DDS_STEP(1865), DDS_STEP(1976),
+    DDS_STEP(2093), DDS_STEP(2217), DDS_STEP(2349), DDS_STEP(2489), DDS_STEP(2637), DDS_STEP(2794),
+    DDS_STEP(2960), DDS_STEP(3136), DDS_STEP(3322), DDS_STEP(3520), DDS_STEP(3729), DDS_STEP(3951),
+    DDS_STEP(4186),
+};
+
+//Melodies
+const note_t alarm_melody[] PROGMEM = //Rising C major, once a second
+{
+    { NOTE_C7, NOTE_MS(120) }, { NOTE_E7, NOTE_MS(120) }, { NOTE_G7, NOTE_MS(120) },
+    { NOTE_C8, NOTE_MS(250) }, { NOTE_REST, NOTE_MS(390) }, { 0, 0 }
+};
+const note_t power_up_melody[] PROGMEM = //Softened turn on buzz
+{
+    { NOTE_G6, NOTE_MS(12) }, { NOTE_REST, NOTE_MS(50) }, { NOTE_G6, NOTE_MS(12) }, { 0, 0 }
+};
+
+//Framebuffer: ready-to-write port values for each multiplex slot
+typedef struct
+{
+    uint8_t portc; //Segments
+    uint8_t portd; //Commons DIG1-4/COL + segments on PORTD
+    uint8_t ampm;  //AM/PM common (PORTB) on
+    uint8_t on;    //On-time in Timer2 counts (OCR2B)
+} display_slot_t;
+
+#define DISPLAY_SLOT_OFF    { DISPLAY_PORTC_OFF, DISPLAY_PORTD_OFF, 0, DISPLAY_ON_MIN }
+#define DISPLAY_FRAME_OFF   { DISPLAY_SLOT_OFF, DISPLAY_SLOT_OFF, DISPLAY_SLOT_OFF, DISPLAY_SLOT_OFF, \
+                              DISPLAY_SLOT_OFF, DISPLAY_SLOT_OFF, DISPLAY_SLOT_OFF }
+
+display_slot_t frame_buffer[2][DISPLAY_SLOTS] = { DISPLAY_FRAME_OFF, DISPLAY_FRAME_OFF };
+const display_slot_t *display_frame = frame_buffer[0]; //Frame being scanned (ISR only)
+volatile uint8_t frame_back = 1; //Buffer display_update() may build into
+volatile uint8_t frame_ready; //Back buffer is built, ISR swaps it in at the start of the next frame
+
+volatile uint8_t display_source; //SHOW_TIME, SHOW_ALARM, SHOW_BLANK, ...
+int16_t display_value; //Number shown by SHOW_NUMBER, -999..9999
+uint8_t display_slot; //Slot currently lit by the multiplex engine
+volatile uint8_t display_isr_max; //Worst TIMER2_COMPA_vect exit time seen, in 2us Timer2 counts
+uint8_t display_level = DISPLAY_LEVELS - 1; //Brightness, 0 is the dimmest
+
+volatile uint8_t events; //EV_* flags posted by the ISRs for the main loop
+
+//Soft timers, see timer_start()
+soft_timer_t timers[TIMERS];
+volatile uint16_t timer_ticks; //Frames since power up, counted by the multiplex engine
+volatile uint16_t timer_next; //timer_ticks the first timer runs out at
+volatile uint8_t timer_armed; //A timer is on, TIMER2_COMPB_vect posts EV_TIMER at timer_next
+volatile uint8_t cpu_asleep; //Main loop is in sleep_cpu()
+uint16_t slots_awake, slots_asleep; //Display slots that found main awake/asleep, this second
+volatile uint16_t cpu_awake_slots; //slots_awake of the last second, out of SLOTS_PER_SECOND
+volatile uint32_t cpu_awake_total, cpu_asleep_total; //Slots awake/asleep since power up
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+#ifdef PROFILE
+//Profiling
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//An ISR reads TCNT0 on entry and again on exit, the difference is its time in 
+//0.5us (8 cycle) counts.  The register saves of the ISR prologue and epilogue are 
+//not in it.  The main loop and the sleeps span more than Timer0's 128us, they use 
+//prof_now(): TCNT0 below the overflow count of TIMER0_OVF_vect.
+typedef struct
+{
+    uint32_t min, max; //Timer0 counts
+    uint32_t sum;
+    uint32_t count;
+} prof_stat_t;
+
+#define PROF_STAT_INIT  { 0xFFFFFFFFUL, 0, 0, 0 }
+
+prof_stat_t prof_compa = PROF_STAT_INIT; //TIMER2_COMPA_vect
+prof_stat_t prof_compb = PROF_STAT_INIT; //TIMER2_COMPB_vect
+prof_stat_t prof_capt = PROF_STAT_INIT; //TIMER1_CAPT_vect
+prof_stat_t prof_dds = PROF_STAT_INIT; //TIMER0_COMPA_vect
+prof_stat_t prof_loop = PROF_STAT_INIT; //One pass of the main loop, ISRs included
+volatile uint16_t prof_t0_hi; //Timer0 overflows, upper 16 bits of prof_now()
+volatile uint32_t prof_isr_total; //Counts spent in ISRs, wraps
+uint32_t prof_idle; //Counts asleep this second
+volatile uint32_t prof_idle_last; //Counts asleep in the last second, out of PROF_COUNTS_PER_SECOND
+
+static inline __attribute__((always_inline)) void prof_add(prof_stat_t *s, uint32_t t)
+{
+    if(t < s->min) s->min = t;
+    if(t > s->max) s->max = t;
+    s->sum += t;
+    s->count++;
+}
+
+#define PROF_ENTER()    uint8_t prof_t0 = TCNT0
+#define PROF_EXIT(stat) do { uint8_t d = TCNT0 - prof_t0; prof_add(&(stat), d); prof_isr_total += d; } while(0)
+//An ISR that turns interrupts on marks where with PROF_NEST() and leaves with 
+//PROF_EXIT_NESTED(), the ISRs it let in have counted for themselves and are taken off
+#define PROF_NEST()     uint8_t prof_nest = prof_isr_total
+#define PROF_EXIT_NESTED(stat) do { uint8_t d = TCNT0 - prof_t0 - (uint8_t)(prof_isr_total - prof_nest); \
+                                    prof_add(&(stat), d); prof_isr_total += d; } while(0)
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#else
+#define PROF_ENTER()
+#define PROF_EXIT(stat)
+#define PROF_NEST()
+#define PROF_EXIT_NESTED(stat)
+#endif
+
+#ifdef TRACE
+//Event trace, see trace()
+trace_t trace_buf[TRACE_SIZE] HAL_NOINIT;
+uint8_t trace_count HAL_NOINIT; //Events recorded, the next goes at trace_count % TRACE_SIZE
+uint8_t trace_magic HAL_NOINIT; //TRACE_MAGIC once trace_start() cleared the ring
+
+//Record an event, from an ISR or main
+//~20 cycles: the entry, the TCNT1 stamp and the count with interrupts off.  The 
+//oldest event is overwritten.  Second ticks carry the low byte of the uptime, so
+//the stamps of the events between them add up to a time line.
+static inline __attribute__((always_inline)) void trace(uint8_t ev, uint8_t arg)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        trace_t *e = &trace_buf[trace_count & (TRACE_SIZE - 1)];
+
+        e->ev = ev;
+        e->arg = arg;
+        e->phase = TCNT1;
+        trace_count++;
+    }
+}
+
+#define TRACE_EVENT(ev, arg)    trace(ev, arg)
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#else
+#define TRACE_EVENT(ev, arg)    do { } while(0)
+#endif
+
+#ifdef CONSOLE
+//Serial console ring buffers, each index is moved by one side only
+uint8_t rx_buf[CONSOLE_RX_SIZE];
+volatile uint8_t rx_head, rx_tail; //USART_RX_vect puts at head, main takes at tail
+volatile uint8_t rx_overrun; //Bytes were lost, the line gets a ? reply
+uint8_t tx_buf[CONSOLE_TX_SIZE];
+volatile uint8_t tx_head, tx_tail; //main puts at head, USART_UDRE_vect sends from tail
+
+//Time sync line parser, USART_RX_vect's.  See sync_rx()
+uint8_t sync_state; //SYNC_START, ...
+uint8_t sync_kind; //SYNC_RMC, SYNC_ZDA, SYNC_T
+uint8_t sync_field, sync_pos; //Field of the sentence, character in it
+uint8_t sync_sum, sync_sum_rx; //Checksum worked out, and the one sent
+uint8_t sync_got; //SYNC_GOT_*
+uint8_t sync_d[SYNC_DIGITS]; //Digits of the time and the date
+uint32_t sync_line_sec; //uptime_sec and TCNT1 at the first byte of the line
+uint16_t sync_line_phase;
+volatile uint8_t sync_ready; //A good line for check_sync(), the next ones are skipped until it is taken
+const char sync_ids[3][4] = { "", "RMC", "ZDA" }; //Sentence names by sync_kind
+const char sync_plain[] = " 00:00:00"; //After the T, 0 is a digit
+
+//Time sync armed by check_sync(), TIMER1_CAPT_vect starts the next second on it
+volatile uint8_t sync_armed;
+tod_t sync_next; //Time of day of the second
+uint8_t sync_next_wday; //Its day of the week, 0xFF if the line had no date
+uint16_t sync_phase; //TCNT1 it starts at
+volatile uint8_t sync_applied; //Done, the time was sync_was
+tod_t sync_was;
+//Time sync statistics
+uint16_t sync_count; //Lines applied
+volatile uint16_t sync_bad; //Lines with a bad checksum or time
+int32_t sync_offset_ms; //How far the clock was off at the last one, + if it was slow
+#endif
 
 ISR (TIMER1_CAPT_vect) 
 {
+    PROF_ENTER();
+    tod_t t;
+
     //Prescalar of 1024
     //Clock = 16MHz
     //15,625 clicks per second
@@ -229,756 +906,2620 @@ ISR (TIMER1_CAPT_vect)
     //Debug with faster time!
     //TCNT1 = 63581; //65536 - 1,953 = 63581 - Preload timer 1 for 63581 clicks. Should be 0.125s per ISR call - 8 times faster than normal time
     
-    flip_alarm = 1;
-    
-    if(flip == 0)
-        flip = 1;
-    else
-        flip = 0;
-        
-    seconds++;
-    if(seconds == 60)
+    t = time_now + 1;
+    if(t == TOD_DAY) //Midnight
     {
-        seconds = 0;
-        minutes++;
-        if(minutes == 60)
-        {
-            minutes = 0;
-            hours++;
+        t = 0;
+        if(++time_wday == WEEK_DAYS) time_wday = 0;
+    }
+#ifdef CONSOLE
+    if(sync_armed) //A time sync line, see check_sync()
+    {
+        sync_armed = FALSE;
+        sync_was = t;
+        t = sync_next;
+        if(sync_next_wday < WEEK_DAYS) time_wday = sync_next_wday;
+        TCNT1 = sync_phase; //The uptime seconds go on, the phase moves
+        sync_applied = TRUE;
+    }
+#endif
+    time_now = t;
+    time_gen++; //Tell time_get() readers to try again
+    uptime_sec++;
+    TRACE_EVENT(TR_TICK, uptime_sec);
+
+    //Awake/asleep statistics of the last second
+    cpu_awake_slots = slots_awake;
+    cpu_awake_total += slots_awake;
+    cpu_asleep_total += slots_asleep;
+    slots_awake = 0;
+    slots_asleep = 0;
+
+#ifdef PROFILE
+    prof_idle_last = prof_idle;
+    prof_idle = 0;
+#endif
 
-            if(hours == 12)
-            {
-                if(ampm == AM)
-                    ampm = PM;
-                else
-                    ampm = AM;
-            }
+    events |= EV_TICK;
 
-            if(hours == 13) hours = 1;
-        }
-    }
+    PROF_EXIT(prof_capt);
 }
 
-ISR (TIMER2_OVF_vect) 
+//Crystal trim, half way through the second
+//The fraction adds up, and the second is one count longer each time it carries.
+//ICR1 is not double buffered in CTC mode and TIMER1_CAPT_vect runs while TCNT1 
+//still holds the old TOP, so a new TOP written there would be missed or counted
+//twice.  Here TCNT1 is far from any TOP.
+ISR (TIMER1_COMPB_vect)
 {
-    display_time(10); //Display current time for 1ms
-}
-
+    uint16_t top = trim_top;
 
-int main (void)
-{
-    ioinit(); //Boot up defaults
-    
-    while(1)
+    trim_acc += trim_frac;
+    if(trim_acc >= TRIM_STEP)
     {
-        check_buttons(); //See if we need to set the time or snooze
-        check_alarm(); //See if the current time is equal to the alarm time
+        trim_acc -= TRIM_STEP;
+        top++;
     }
-    
-    return(0);
+
+    ICR1 = top;
 }
 
-//Check to see if the time is equal to the alarm time
-void check_alarm(void)
+//Seconds since power-up, and the phase within the second in Timer1 counts (64us),
+//with interrupts off.  TCNT1 goes from TOP to 0 one count after the capture flag
+//is set, and TIMER1_CAPT_vect runs during that count.  A capture still pending 
+//with TCNT1 already 0 is a second not counted yet, TCNT1 still at TOP with the 
+//capture done is the start of the new one.  The phase runs 0..ICR1, a trimmed 
+//second can be a count longer or shorter than TIMER1_TOP.
+static inline __attribute__((always_inline)) uint32_t uptime_read(uint16_t *phase)
 {
-    //Check wether the alarm slide switch is on or off
-    if( (PINB & (1<<BUT_ALARM)) != 0)
-    {
-        if (alarm_going == FALSE)
-        {
-            //Check to see if the time equals the alarm time
-            if( (hours == hours_alarm) && (minutes == minutes_alarm) && (seconds == seconds_alarm) && (ampm == ampm_alarm) && (snooze == FALSE) )
-            {
-                //Set it off!
-                alarm_going = TRUE;
-            }
+    uint32_t s = uptime_sec;
+    uint16_t p = TCNT1;
 
-            //Check to see if we need to set off the alarm again after a ~9 minute snooze
-            if( (hours == hours_alarm_snooze) && (minutes == minutes_alarm_snooze) && (seconds == seconds_alarm_snooze) && (ampm == ampm_alarm_snooze) && (snooze == TRUE) )
-            {
-                //Set it off!
-                alarm_going = TRUE;
-            }
-        }
+    if(TIFR1 & (1<<ICF1))
+    {
+        if(p < TIMER1_TOP / 2) s++;
     }
-    else
-        alarm_going = FALSE;
+    else if(p >= ICR1)
+        p = 0;
+
+    *phase = p;
+    return(s);
 }
 
-//Checks buttons for system settings
-void check_buttons(void)
+//Debounce the inputs, once a frame from the multiplex engine
+//Vertical counters: bit n of input_ct1:input_ct0 counts the frames input n has 
+//differed from input_state and starts over whenever they agree.  On the 4th in
+//a row it flips (steady for 8.4ms), all inputs at once in about a dozen 
+//instructions.  While buttons are down the hold and repeat counts run down, a
+//change of the buttons starts them over.
+static inline __attribute__((always_inline)) void input_tick(void)
 {
-    uint8_t i;
-    uint8_t sling_shot = 0;
-    uint8_t minute_change = 1;
-    uint8_t previous_button = 0;
-    
-    //If the user hits snooze while alarm is going off, record time so that we can set off alarm again in 9 minutes
-    if ( (PIND & (1<<BUT_SNOOZE)) == 0 && alarm_going == TRUE)
-    {
-        alarm_going = FALSE; //Turn off alarm
-        snooze = TRUE; //But remember that we are in snooze mode, alarm needs to go off again in a few minutes
-        
-        seconds_alarm_snooze = 0;
-        minutes_alarm_snooze = minutes + 9; //Snooze to 9 minutes from now
-        hours_alarm_snooze = hours;
-        ampm_alarm_snooze = ampm;
-        
-        if(minutes_alarm_snooze > 59)
-        {
-            minutes_alarm_snooze -= 60;
-            hours_alarm_snooze++;
+    uint8_t state = input_state;
+    uint8_t i, down;
 
-            if(hours_alarm_snooze == 12)
-            {
-                if(ampm_alarm_snooze == AM) 
-                    ampm_alarm_snooze = PM;
-                else
-                    ampm_alarm_snooze = AM;
-            }
+    i = state ^ ( ((PINB & INPUT_PINB) | (PIND & INPUT_PIND)) ^ INPUT_BUTTONS );
+    input_ct0 = ~(input_ct0 & i);
+    input_ct1 = input_ct0 ^ (input_ct1 & i);
+    i &= input_ct0 & input_ct1; //Counted out
 
-            if(hours_alarm_snooze == 13) hours_alarm_snooze = 1;
+    if(i != 0)
+    {
+        state ^= i;
+        input_state = state;
+        input_press |= state & i;
+        input_release |= ~state & i;
+        if(i & INPUT_BUTTONS)
+        {
+            input_hold_count = FRAME_TICKS(INPUT_HOLD_MS);
+            input_repeat_count = FRAME_TICKS(INPUT_REPEAT_START_MS);
         }
-        
+        events |= EV_INPUT;
     }
 
-    //Check for set time
-    if ( (PINB & ((1<<BUT_UP)|(1<<BUT_DOWN))) == 0)
+    down = state & INPUT_BUTTONS;
+    if(down != 0)
     {
-        delay_ms(1000);
-
-        if ( (PINB & ((1<<BUT_UP)|(1<<BUT_DOWN))) == 0)
+        if(input_hold_count != 0 && --input_hold_count == 0)
         {
-            //You've been holding up and down for 2 seconds
-            //Set time!
+            input_hold = down; //This combination, once
+            events |= EV_INPUT;
+        }
+        if(--input_repeat_count == 0)
+        {
+            input_repeat_count = FRAME_TICKS(INPUT_REPEAT_MS);
+            input_repeat |= down;
+            events |= EV_INPUT;
+        }
+    }
+}
 
-            //siren(500); //Make some noise to show that you're setting the time
+//Step the melody, once a frame from TIMER2_COMPB_vect
+//A decrement while a note plays, a note from flash when the next one starts.
+static inline void buzz_tick(void) __attribute__((always_inline));
+static inline void buzz_tick(void)
+{
+    if(buzz_count == 0) return; //Quiet
 
-            while( (PINB & ((1<<BUT_UP)|(1<<BUT_DOWN))) == 0) //Wait for you to stop pressing the buttons
-                display_time(1000); //Display current time for 1000ms
+    if(buzz_ramp != 0 && --buzz_ramp_count == 0) //Louder
+    {
+        buzz_ramp_count = buzz_ramp;
+        if(buzz_volume < DDS_DUTY_MAX) buzz_volume++;
+        if(dds_duty != 0) dds_duty = buzz_volume;
+    }
 
-            while(1)
-            {
-                if ( (PIND & (1<<BUT_SNOOZE)) == 0) //All done!
-                {
-                    for(i = 0 ; i < 3 ; i++)
-                    {
-                        display_time(250); //Display current time for 100ms
-                        clear_display();
-                        delay_ms(250);
-                    }
-                    
-                    while((PIND & (1<<BUT_SNOOZE)) == 0) ; //Wait for you to release button
-                    
-                    break; 
-                }
+    if(--buzz_count == 0) buzz_note();
+}
 
-                if ( (PINB & (1<<BUT_UP)) == 0)
-                {
-                    //Ramp minutes faster if we are holding the button
-                    //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
-                    if(previous_button == BUT_UP) 
-                        sling_shot++;
-                    else
-                    {   
-                        sling_shot = 0;
-                        minute_change = 1;
-                    }
-                        
-                    previous_button = BUT_UP;
-                    
-                    if (sling_shot > 5)
-                    {
-                        minute_change++;
-                        if(minute_change > 30) minute_change = 30;
-                        sling_shot = 0;
-                    }
-                    //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
-                    
-                    minutes += minute_change;
-                    if (minutes > 59)
-                    {
-                        minutes -= 60;
-                        hours++;
-
-                        if(hours == 13) hours = 1;
-
-                        if(hours == 12)
-                        {
-                            if(ampm == AM) 
-                                ampm = PM;
-                            else
-                                ampm = AM;
-                        }
-                    }
-                    delay_ms(100);
-                }
-                
-                if ( (PINB & (1<<BUT_DOWN)) == 0)
-                {
-                    //Ramp minutes faster if we are holding the button
-                    //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
-                    if(previous_button == BUT_DOWN) 
-                        sling_shot++;
-                    else
-                    {
-                        sling_shot = 0;
-                        minute_change = 1;
-                    }
-                        
-                    previous_button = BUT_DOWN;
-                    
-                    if (sling_shot > 5)
-                    {
-                        minute_change++;
-                        if(minute_change > 30) minute_change = 30;
-                        sling_shot = 0;
-                    }
-                    //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//Tone synthesizer: one sample every DDS_TICK_US while a melody plays
+//The phase accumulator goes round dds_step / 65536 times a sample, a tone of 
+//dds_step * DDS_RATE / 65536 Hz.  The piezo is driven both ways: BUZZ2 high for the
+//first dds_duty/256 of a turn, BUZZ1 high for as long from half a turn, else both
+//low.  At DDS_DUTY_MAX that is the full complementary square wave, a shorter pulse
+//is quieter.  Timer0 runs free, OCR0A moves on DDS_TICKS a sample, so prof_now() 
+//keeps working.  ~70 cycles (4.4us) a sample, 14% of the CPU while a tone plays 
+//and none when quiet.  Every 32us that would hold off TIMER2_COMPA_vect and move
+//the display slot edges by up to 4.4us, so the sample is worked out with 
+//interrupts on: the multiplex engine only waits for the entry and the copy of 
+//the tone (~1.5us), and for the PORTB write at the end, which is shared with the
+//AM/PM dot.  Its own flag is cleared on entry and a sample is done long before 
+//the next one is due, so it doesn't nest.  The ISRs that come in meanwhile are
+//taken off its profile (PROF_EXIT_NESTED()), not counted twice.
+ISR (TIMER0_COMPA_vect)
+{
+    PROF_ENTER();
+    uint16_t step = dds_step; //buzz_tick() changes them from TIMER2_COMPB_vect
+    uint8_t duty = dds_duty;
+    uint8_t p, out = 0;
+
+    PROF_NEST();
+    sei(); //Let the multiplex engine in
+    OCR0A += DDS_TICKS; //Next sample
+    dds_phase += step;
+    p = dds_phase >> 8;
+
+    if(p < duty)
+        out = (1<<BUZZ2);
+    else if((uint8_t)(p - 128) < duty)
+        out = (1<<BUZZ1);
+
+    cli();
+    PORTB = (PORTB & ~((1<<BUZZ1)|(1<<BUZZ2))) | out;
+
+    PROF_EXIT_NESTED(prof_dds);
+}
 
+//Multiplex engine: light the next slot of the display and return
+//Every DISPLAY_SLOT_US one of DIG1, DIG2, DIG3, DIG4, COL, alarm dot or AM/PM dot is
+//lit from the precomputed frame.  TIMER2_COMPB_vect turns it off again after the
+//slot's on-time.  Unused slots (leading zero, colon off, ...) are built dark so every 
+//slot takes the same time.  A new frame from display_update() is only swapped in at 
+//slot 0, so a whole scan always shows one consistent frame (no 12:59 -> 1:00 tearing).
+//The on-time of the slot counts from when it is lit: TCNT2 is read, the slot lit 
+//and OCR2B set the on-time on from that count, so another interrupt holding this 
+//one off (the tick, the console, the tone) moves the slot but doesn't shorten it,
+//and neither does the ~3us entry of this one.  OCR2B is not buffered in CTC mode, a value TCNT2
+//is already past never matches and the slot would stay lit for the whole slot (and
+//the AM/PM dot into the next).  It is set DISPLAY_ON_MIN - 1 counts or more past 
+//the count read a few cycles before, and never at TOP, where compare B would come
+//after the next slot is lit.  A slot held off so long that its on-time would not 
+//end within the slot is left dark, with compare B moved to the next count to do 
+//its work.  Compare B can't end the slot before this interrupt returns, so the 
+//slow work at slot 0 is in TIMER2_COMPB_vect.  display_isr_max records the worst 
+//exit time in Timer2 counts (2us = 32 cycles).
+ISR (TIMER2_COMPA_vect)
+{
+    PROF_ENTER();
+    const display_slot_t *slot;
+    uint8_t t;
 
-                    minutes -= minute_change;
-                    if(minutes > 60)
-                    {
-                        minutes = 59;
-                        hours--;
-                        if(hours == 0) hours = 12;
-
-                        if(hours == 11)
-                        {
-                            if(ampm == AM) 
-                                ampm = PM;
-                            else
-                                ampm = AM;
-                        }
-                    }
-                    delay_ms(100);
-                }
-                
-                //clear_display(); //Blink display
-                //delay_ms(100);
-            }
+    if(++display_slot == DISPLAY_SLOTS)
+    {
+        display_slot = 0;
+
+        if(frame_ready)
+        {
+            display_frame = frame_buffer[frame_back];
+            frame_back ^= 1;
+            frame_ready = FALSE;
+            events |= EV_FRAME; //display_update() may have more to show
         }
     }
 
-
-    //Check for set alarm
-    if ( (PIND & (1<<BUT_SNOOZE)) == 0)
+    //All commons are off here (TIMER2_COMPB_vect), set the segments first
+    slot = &display_frame[display_slot];
+    t = TCNT2 + 1; //Counts since the compare match, TCNT2 stays at TOP for the first count
+    if(t == DISPLAY_SLOT_TICKS) t = 0;
+    if(t < DISPLAY_SLOT_TICKS - slot->on)
+    {
+        PORTC = slot->portc;
+        PORTD = slot->portd;
+        if(slot->ampm) DISPLAY_AMPM_ON();
+        OCR2B = t + slot->on - 1; //Matches on - 1 to on counts from here
+    }
+    else
     {
-        TIMSK2 = 0;
-        display_alarm_time(1000);
+        OCR2B = (t < DISPLAY_SLOT_TICKS - 1) ? t + 1 : DISPLAY_SLOT_TICKS - 1; //Too late, dark
+        TRACE_EVENT(TR_OVERRUN, TR_OVR_SLOT);
+    }
 
-        if ( (PIND & (1<<BUT_SNOOZE)) == 0)
-        {
-            //You've been holding snooze for 2 seconds
-            //Set alarm time!
+    //Sample the main loop: woken up by this interrupt or already running?
+    if(cpu_asleep)
+        slots_asleep++;
+    else
+        slots_awake++;
 
-            //Disable the regular display clock interrupt
-            TIMSK2 = 0;
+    t = TCNT2 + 1; //Counts since the compare match, TCNT2 stays at TOP for the first count
+    if(t == DISPLAY_SLOT_TICKS) t = 0;
+    if(t > display_isr_max) display_isr_max = t;
 
-            while( (PIND & (1<<BUT_SNOOZE)) == 0) //Wait for you to stop pressing the buttons
-            {
-                clear_display();
-                delay_ms(250);
+    PROF_EXIT(prof_compa);
+}
 
-                display_alarm_time(250); //Display current time for 1000ms
-            }
+//End of the slot on-time
+//Once a frame, with the display dark, the inputs are debounced (input_tick()), the
+//melody steps (buzz_tick()) and the soft timers tick: one compare with the first 
+//one due, see timer_arm().  Where in the second the frame is goes to warm_sec and 
+//warm_phase for a warm restart.
+ISR (TIMER2_COMPB_vect)
+{
+    PROF_ENTER();
+    uint16_t phase;
 
-            while(1)
-            {
-                display_alarm_time(100); //Display current time for 100ms
-                
-                if ( (PIND & (1<<BUT_SNOOZE)) == 0) //All done!
-                {
-                    for(i = 0 ; i < 4 ; i++)
-                    {
-                        display_alarm_time(250); //Display current time for 100ms
-                        clear_display();
-                        delay_ms(250);
-                    }
-                    
-                    while((PIND & (1<<BUT_SNOOZE)) == 0) ; //Wait for you to release button
-                    
-                    TIMSK2 = (1<<TOIE2); //Re-enable the timer 2 interrupt
-                    
-                    break; 
-                }
+    clear_display();
 
-                if ( (PINB & (1<<BUT_UP)) == 0)
-                {
-                    //Ramp minutes faster if we are holding the button
-                    //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
-                    if(previous_button == BUT_UP) 
-                        sling_shot++;
-                    else
-                    {   
-                        sling_shot = 0;
-                        minute_change = 1;
-                    }
-                        
-                    previous_button = BUT_UP;
-                    
-                    if (sling_shot > 5)
-                    {
-                        minute_change++;
-                        if(minute_change > 30) minute_change = 30;
-                        sling_shot = 0;
-                    }
-                    //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+    if(display_slot == 0)
+    {
+        input_tick();
+        buzz_tick();
 
-                    minutes_alarm += minute_change;
-                    if (minutes_alarm > 59)
-                    {
-                        minutes_alarm -= 60;
-                        hours_alarm++;
-                        if(hours_alarm == 13) hours_alarm = 1;
-
-                        if(hours_alarm == 12)
-                        {
-                            if(ampm_alarm == AM) 
-                                ampm_alarm = PM;
-                            else
-                                ampm_alarm = AM;
-                        }
-                    }
-                    //delay_ms(100);
-                }
-                
-                if ( (PINB & (1<<BUT_DOWN)) == 0)
-                {
-                    //Ramp minutes faster if we are holding the button
-                    //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
-                    if(previous_button == BUT_DOWN) 
-                        sling_shot++;
-                    else
-                    {   
-                        sling_shot = 0;
-                        minute_change = 1;
-                    }
-                        
-                    previous_button = BUT_DOWN;
-                    
-                    if (sling_shot > 5)
-                    {
-                        minute_change++;
-                        if(minute_change > 30) minute_change = 30;
-                        sling_shot = 0;
-                    }
-                    //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+        if(++timer_ticks == timer_next && timer_armed) events |= EV_TIMER;
 
-                    minutes_alarm -= minute_change;
-                    if(minutes_alarm > 60)
-                    {
-                        minutes_alarm = 59;
-                        hours_alarm--;
-                        if(hours_alarm == 0) hours_alarm = 12;
-
-                        if(hours_alarm == 11)
-                        {
-                            if(ampm_alarm == AM) 
-                                ampm_alarm = PM;
-                            else
-                                ampm_alarm = AM;
-                        }
-                    }
-                    //delay_ms(100);
-                }
-                
-                //clear_display(); //Blink display
-                //delay_ms(100);
-            }
-        }
-        else
-            TIMSK2 = (1<<TOIE2); //Re-enable the timer 2 interrupt
+        warm_sec = uptime_read(&phase);
+        warm_phase = phase;
+    }
 
+    PROF_EXIT(prof_compb);
+}
+
+//EEPROM ready: write the next byte of persist_rec, one every ~3.4ms
+//EEPE has to follow EEMPE within 4 cycles, interrupts are off in here.  The 
+//interrupt after the last byte turns itself off, so EERIE stays on until the whole
+//record is in the EEPROM.
+ISR (EE_READY_vect)
+{
+    uint8_t i = sizeof(persist_t) - persist_left;
+
+    if(persist_left == 0)
+    {
+        EECR &= ~(1<<EERIE);
+        return;
     }
 
+    EEAR = persist_slot * sizeof(persist_t) + i;
+    EEDR = ((const uint8_t *)&persist_rec)[i];
+    EECR |= (1<<EEMPE);
+    EECR |= (1<<EEPE); //Erase and write
+    persist_left--;
 }
 
-void clear_display(void)
+#ifdef CONSOLE
+//Start a time sync line, c is '$' or 'T'
+//The time of a line is the time its first byte started, stamped here.  A line 
+//that comes in while check_sync() has not taken the last one is skipped.
+static inline __attribute__((always_inline)) void sync_begin(uint8_t c)
 {
-    cbi(PORTB, AMPM); // AMPM anode off=0
-    PORTC = 0b00111111;  // Set BGACFE cathode off=1
-    PORTD &= 0b10100100; // Set DIG4,DIG3,COL,DIG2,DIG1 anodes off=0 PD752=NC=1
-    PORTD |= 0b00100100; // Set DP,D cathode off=1 PD764310=NC=0
+    if(sync_ready)
+    {
+        sync_state = SYNC_SKIP;
+        return;
+    }
+
+    sync_line_sec = uptime_read(&sync_line_phase);
+    sync_state = (c == '$') ? SYNC_ID : SYNC_PLAIN;
+    sync_kind = (c == '$') ? 0 : SYNC_T;
+    sync_field = 0;
+    sync_pos = 0;
+    sync_sum = 0;
+    sync_sum_rx = 0;
+    sync_got = 0;
+    sync_d[SYNC_D_CS] = 0; //No hundredths is .00
+    sync_d[SYNC_D_CS + 1] = 0;
 }
 
-void display_number(uint8_t number, uint8_t digit)
+//Time sync line parser, a byte at a time from USART_RX_vect
+//"$ttRMC,hhmmss.ss,A,...,ddmmyy,...*hh" with a fix (status A) and
+//"$ttZDA,hhmmss.ss,dd,mm,yyyy,...*hh" of any talker give the time, and the date
+//for the day of the week, if the XOR of the bytes between the $ and the * is 
+//the checksum sent.  "T hh:mm:ss" gives the time.  The digits are kept in 
+//sync_d[] and everything else is checked as it goes by, a few compares a byte, 
+//and a line that is not one of these is skipped to its end.  A good one is 
+//handed to check_sync() at the line end.
+static inline __attribute__((always_inline)) void sync_rx(uint8_t c, uint8_t eol)
 {
-    clear_display();
-    
-    //Set the digit/colon/ampm (common anode)
-    switch(digit)
+    uint8_t state = sync_state;
+    uint8_t idx = 0xFF;
+    uint8_t good = FALSE;
+
+    if(eol)
     {
-        case 1:
-            PORTD |= (1<<DIG_1);//Select Digit 1
-            break;
-        case 2:
-            PORTD |= (1<<DIG_2);//Select Digit 2
-            break;
-        case 3:
-            PORTD |= (1<<DIG_3);//Select Digit 3
-            break;
-        case 4:
-            PORTD |= (1<<DIG_4);//Select Digit 4
-            break;
-        case 5:
-            PORTD |= (1<<COL);//Select Digit COL
-            break;
-        case 6:
-            sbi(PORTB, AMPM); // AMPM anode on=1
-        default: 
-            break;
+        if(state == SYNC_SUM && sync_pos == 2)
+        {
+            if(sync_sum_rx != sync_sum)
+                sync_bad++;
+            else if( (sync_got & SYNC_GOT_TIME) && (sync_kind != SYNC_RMC || (sync_got & SYNC_GOT_FIX)) )
+                good = TRUE;
+        }
+        else if(state == SYNC_PLAIN && sync_pos == sizeof(sync_plain) - 1)
+            good = TRUE;
+
+        if(good)
+        {
+            sync_ready = TRUE;
+            events |= EV_CONSOLE;
+        }
+        sync_state = SYNC_START;
+        return;
     }
-    
-    //Set number cathode
-    switch(number)
+
+    switch(state)
     {
-        case 0:
-            PORTC &= 0b11010000; //Segments ABCEF
-            PORTD &= 0b11111011; //Segments D
-            break;
-        case 1:
-            PORTC &= 0b11011011; //Segments BC
-            break;
-        case 2:
-            PORTC &= 0b11000110; //Segments ABEG
-            PORTD &= 0b11111011; //Segments D
-            break;
-        case 3:
-            PORTC &= 0b11000011; //Segments ABCG
-            PORTD &= 0b11111011; //Segments D
-            break;
-        case 4:
-            PORTC &= 0b11001001; //Segments BCGF
-            break;
-        case 5:
-            PORTC &= 0b11100001; //Segments ACFG
-            PORTD &= 0b11111011; //Segments D
-            break;
-        case 6:
-            PORTC &= 0b11100000; //Segments AFGCE
-            PORTD &= 0b11111011; //Segments D
-            break;
-        case 7:
-            PORTC &= 0b11010011; //Segments ABC
-            break;
-        case 8:
-            PORTC &= 0b11000000; //Segments ABCEFG
-            PORTD &= 0b11111011; //Segments D
-            break;
-        case 9:
-            PORTC &= 0b11000001; //Segments ABCFG
-            PORTD &= 0b11111011; //Segments D
+        case SYNC_ID:
+            sync_sum ^= c;
+            if(c == ',')
+            {
+                state = (sync_pos == 5 && sync_kind != 0) ? SYNC_FIELDS : SYNC_SKIP;
+                sync_field = 1;
+                sync_pos = 0;
+                break;
+            }
+            if(sync_pos == 2)
+                sync_kind = (c == 'R') ? SYNC_RMC : (c == 'Z') ? SYNC_ZDA : 0;
+            else if(sync_pos > 2 && c != sync_ids[sync_kind][sync_pos - 2])
+                sync_kind = 0;
+            if(++sync_pos > 5) state = SYNC_SKIP;
             break;
 
-        case 10:
-            //Colon
-            PORTC &= 0b11111011; //Segments [C] 
-            break;
+        case SYNC_FIELDS:
+            if(c == '*')
+            {
+                state = SYNC_SUM;
+                sync_pos = 0;
+                break;
+            }
+            sync_sum ^= c;
+            if(c == ',')
+            {
+                if(sync_field < 0xFF) sync_field++;
+                sync_pos = 0;
+                break;
+            }
+
+            if(sync_field == 1) //hhmmss.ss
+            {
+                if(sync_pos < 6) idx = SYNC_D_TIME + sync_pos;
+                else if(sync_pos == 7 || sync_pos == 8) idx = SYNC_D_CS + sync_pos - 7;
+            }
+            else if(sync_kind == SYNC_RMC)
+            {
+                if(sync_field == 2 && c == 'A') sync_got |= SYNC_GOT_FIX;
+                if(sync_field == 9 && sync_pos < 6) idx = SYNC_D_DATE + sync_pos;
+            }
+            else if(sync_field == 2 || sync_field == 3) //ZDA dd,mm
+            {
+                if(sync_pos < 2) idx = SYNC_D_DATE + (sync_field - 2) * 2 + sync_pos;
+            }
+            else if(sync_field == 4) //ZDA yyyy
+            {
+                if(sync_pos == 2 || sync_pos == 3) idx = SYNC_D_DATE + 2 + sync_pos;
+            }
 
-        case 11:
-            //Alarm dot
-            PORTD &= 0b11011111; //Segments DP
+            if(idx != 0xFF)
+            {
+                if(c < '0' || c > '9')
+                {
+                    state = SYNC_SKIP;
+                    break;
+                }
+                sync_d[idx] = c - '0';
+                if(idx == SYNC_D_TIME + 5) sync_got |= SYNC_GOT_TIME;
+                if(idx == SYNC_D_DATE + 5) sync_got |= SYNC_GOT_DATE;
+            }
+            if(sync_pos < 0xFF) sync_pos++;
             break;
 
-        case 12:
-            //AMPM dot
-            PORTC &= 0b11111101; //Segments [F]
+        case SYNC_SUM:
+            if(c >= '0' && c <= '9') idx = c - '0';
+            else if(c >= 'A' && c <= 'F') idx = c - 'A' + 10;
+            if(idx == 0xFF || sync_pos == 2)
+            {
+                state = SYNC_SKIP;
+                break;
+            }
+            sync_sum_rx = (sync_sum_rx << 4) | idx;
+            sync_pos++;
             break;
 
-        default: 
+        case SYNC_PLAIN:
+            if(sync_pos == sizeof(sync_plain) - 1)
+                state = SYNC_SKIP; //Too long
+            else if(sync_plain[sync_pos] != '0')
+            {
+                if(c != sync_plain[sync_pos]) state = SYNC_SKIP;
+            }
+            else if(c < '0' || c > '9')
+                state = SYNC_SKIP;
+            else
+                sync_d[SYNC_D_TIME + sync_field++] = c - '0';
+            sync_pos++;
             break;
     }
-    
+
+    sync_state = state;
 }
 
-//Displays current time
-//Brightness level is an amount of time the LEDs will be in - 200us is pretty dim but visible.
-//Amount of time during display is around : [ BRIGHT_LEVEL(us) * 5 + 10ms ] * 10
-//Roughly 11ms * 10 = 110ms
-//Time on is in (ms)
-void display_time(uint16_t time_on)
+//Console byte in: into the RX ring, main is woken at the end of a line
+//The last free byte is kept for a line end, so a line that didn't fit still ends
+//where it should and the next one is read as sent.  Time sync lines go to 
+//sync_rx() instead.
+ISR (USART_RX_vect)
 {
-    //uint16_t bright_level = 1000;
-    uint16_t bright_level = 50;
-    //uint16_t bright_level = 100;
-    
-    //time_on /= 11; //Take the time_on and adjust it for the time it takes to run the display loop below
-    
-    for(uint16_t j = 0 ; j < time_on ; j++)
+    uint8_t status = UCSR0A;
+    uint8_t c = UDR0;
+    uint8_t head = rx_head;
+    uint8_t room = (rx_tail - head - 1) & (CONSOLE_RX_SIZE - 1);
+    uint8_t eol = (c == '\r' || c == '\n');
+
+    if(sync_state == SYNC_START && (c == '$' || c == 'T'))
+        sync_begin(c);
+    else if(sync_state != SYNC_START && sync_state != SYNC_CONSOLE)
     {
-
-#ifdef NORMAL_TIME
-        //Display normal hh:mm time
-        if(hours > 9)
+        if(status & ((1<<FE0)|(1<<DOR0)))
         {
-            display_number(hours / 10, 1); //Post to digit 1
-            delay_us(bright_level);
+            sync_state = SYNC_SKIP; //Garbled
+            TRACE_EVENT(TR_OVERRUN, TR_OVR_RX);
         }
+        sync_rx(c, eol);
+    }
+    else
+    {
+        sync_state = eol ? SYNC_START : SYNC_CONSOLE;
 
-        display_number(hours % 10, 2); //Post to digit 2
-        delay_us(bright_level);
+        if( (status & ((1<<FE0)|(1<<DOR0))) || room <= !eol )
+        {
+            rx_overrun = TRUE; //Garbled or no room
+            TRACE_EVENT(TR_OVERRUN, TR_OVR_RX);
+        }
+        else
+        {
+            rx_buf[head] = c;
+            rx_head = (head + 1) & (CONSOLE_RX_SIZE - 1);
+        }
 
-        display_number(minutes / 10, 3); //Post to digit 3
-        delay_us(bright_level);
+        if(eol) events |= EV_CONSOLE;
+    }
+}
+
+//Console byte out: the next one from the TX ring, stop asking once it is empty
+ISR (USART_UDRE_vect)
+{
+    uint8_t tail = tx_tail;
+
+    if(tail != tx_head)
+    {
+        UDR0 = tx_buf[tail];
+        tail = (tail + 1) & (CONSOLE_TX_SIZE - 1);
+        tx_tail = tail;
+    }
+
+    if(tail == tx_head) UCSR0B &= ~(1<<UDRIE0);
+}
+#endif
+
+#ifdef PROFILE
+//Upper bits of the profiling timestamp
+ISR (TIMER0_OVF_vect)
+{
+    uint8_t t = TCNT0;
+
+    prof_t0_hi++;
+
+    prof_isr_total += (uint8_t)(TCNT0 - t);
+}
+#endif
+
+
+int main (void)
+{
+    uint8_t ev = EV_TICK; //Events the last wait_for_event() returned
+#ifdef PROFILE
+    uint32_t prof_loop_at; //Start of this pass of the main loop
+#endif
+
+    ioinit(); //Boot up defaults
+    
+    while(1)
+    {
+#ifdef PROFILE
+        prof_loop_at = prof_now();
+#endif
+#ifdef WATCHDOG
+        wdt_reset(); //Still going round, TIMER_WATCHDOG makes sure it does often enough
+#endif
+
+        check_timers(); //Run what is due
+
+#ifdef CONSOLE
+        check_console(); //Run the command lines that came in
+#endif
+        check_buttons(); //See if we need to set the time or snooze
+        if(ev & EV_TICK) check_alarm(); //See if an alarm came due, once a second
+        check_alarm_switch(); //Sound the alarm, or stop it
+        check_persist(); //Save what changed to EEPROM
+        check_warm(); //Snapshot for a warm restart
+        display_update(); //Rebuild the frame if the time changed
+
+#ifdef PROFILE
+        prof_add(&prof_loop, (prof_now() - prof_loop_at) & PROF_MASK);
+#endif
+
+        ev = wait_for_event(); //Sleep until a tick, a button or a new frame
+    }
+    
+    return(0);
+}
+
+//Sleep until an ISR posts an event, returns and clears the EV_* flags
+//Interrupts are enabled by the instruction before SLEEP, so an event posted 
+//after the check still wakes us up.  Any other interrupt (display slots) just
+//goes back to sleep.
+//With PROFILE the time asleep, less the ISRs that ran meanwhile, adds up in prof_idle.
+uint8_t wait_for_event(void)
+{
+    uint8_t ev;
+#ifdef PROFILE
+    uint32_t slept_at, isr_at;
+#endif
+
+    while(1)
+    {
+        cli();
+        ev = events;
+        if(ev != 0) break;
+
+        cpu_asleep = TRUE;
+#ifdef PROFILE
+        slept_at = prof_now();
+        isr_at = prof_isr_total;
+#endif
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        cpu_asleep = FALSE;
+
+#ifdef PROFILE
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            prof_idle += ((prof_now() - slept_at) & PROF_MASK) - (prof_isr_total - isr_at);
+        }
+#endif
+    }
+
+    events = 0;
+    sei();
+
+    return(ev);
+}
+
+//Check to see if the next alarm came due, on each second tick
+//alarm_schedule() found it beforehand and the uptime second it is due in, so this
+//is one compare however many alarms there are.  Ticks that come while main is 
+//busy are one event, so the compare is due-or-past: an alarm or snooze that came
+//due meanwhile still goes off, late, and alarm_late_ms says by how much.  One 
+//that comes due with the alarm switch off goes by quietly.
+void check_alarm(void)
+{
+    uint8_t wday;
+    uint16_t phase;
+    uint32_t up, late;
+    tod_t now = time_get_tick(&wday, &up);
+#ifdef TRACE
+    static uint32_t up_seen; //Second of the last call
+
+    if(up_seen != 0 && up - up_seen > 1) trace(TR_OVERRUN, TR_OVR_TICK);
+    up_seen = up;
+#endif
+
+    if(alarm_resched) alarm_schedule(now, wday, up); //The time moved: from the new one on
+
+    if( alarm_due == TOD_NEVER || (int32_t)(up - alarm_due_up) < 0 ) return;
+
+    //Set it off!
+    if( (input_state & (1<<BUT_ALARM)) != 0) alarm_going = TRUE;
+
+    late = (uptime_get(&phase) - alarm_due_up) * 1000UL + phase * 64UL / 1000;
+    alarm_late_ms = (late > 0xFFFF) ? 0xFFFF : late;
+    if(alarm_late_ms > alarm_late_max) alarm_late_max = alarm_late_ms;
+    alarm_fired++;
+    TRACE_EVENT(TR_ALARM, alarm_going | (snooze << 1));
+
+    if(snooze == FALSE)
+    {
+        //One-shots that were due then are done
+        for(uint8_t i = 0 ; i < ALARMS ; i++)
+            if( (alarms[i].days & ALARM_ONCE) && alarms[i].time == alarm_due && (alarms[i].days & (1 << alarm_due_day)) )
+                alarms[i].days = 0;
+    }
+    snooze = FALSE; //A snooze that ran out is over, the alarms are back on
+    time_snooze = TOD_NEVER;
+    alarm_schedule(now, wday, up); //The next one after this second
+}
+
+//Follow the alarm slide switch and start or stop the buzzer, every pass
+void check_alarm_switch(void)
+{
+    //Check wether the alarm slide switch is on or off
+    if( (input_state & (1<<BUT_ALARM)) == 0)
+    {
+        alarm_going = FALSE;
+
+        if(snooze == TRUE)
+        {
+            snooze = FALSE; //If the alarm switch is turned off, this resets the ~9 minute addtional snooze timer
+            time_snooze = TOD_NEVER;
+            alarm_resched = TRUE;
+            TRACE_EVENT(TR_SNOOZE, 1);
+        }
+    }
+
+    //If the alarm slide is on, and alarm_going is true, make noise!
+    //The buzzer runs on its own, this only starts and stops it
+    if(alarm_going != alarm_sounding)
+    {
+        alarm_sounding = alarm_going;
+
+        if(alarm_going == TRUE)
+            buzzer_start(alarm_melody, TRUE, ALARM_RAMP); //Wakes you up gently
+        else
+            buzzer_stop();
+    }
+}
+
+//User interface
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//check_buttons() runs one step of the UI per pass of the main loop and returns, 
+//so the alarm, the console and saving to EEPROM keep going in every mode.  A mode
+//is entered by holding its buttons for INPUT_HOLD_MS (a hold event):
+//  UI_CLOCK_SET    UP and DOWN             the time
+//  UI_ALARM_SET    SNOOZE                  the alarm time, it blinks until let go
+//  UI_CALIBRATE    DOWN, then SNOOZE       the crystal trim
+//  UI_DIAGNOSTICS  UP, then SNOOZE         profiling pages (PROFILE)
+//  UI_TRACE        UP, DOWN and SNOOZE     event trace pages (TRACE)
+//It starts in UI_HELD until those buttons are let go, then in UI_EDIT UP and DOWN
+//step the value, faster as the button is held, and SNOOZE is done: in UI_DONE 
+//the value blinks a few times off TIMER_UI and it is back to UI_TIME, again 
+//UI_HELD until SNOOZE is let go.  Hitting SNOOZE while the alarm goes off is a
+//snooze in any mode.  In UI_TIME a tap of UP or DOWN (let go before it is held,
+//no other button down) makes the display brighter or dimmer.
+
+//Checks buttons for system settings
+void check_buttons(void)
+{
+    uint8_t held, key, repeat, released;
+
+    //If the user hits snooze while alarm is going off, record time so that we can set off alarm again in 9 minutes
+    if( alarm_going == TRUE && input_take(&input_press, (1<<BUT_SNOOZE)) )
+    {
+        alarm_going = FALSE; //Turn off alarm
+        snooze = TRUE; //But remember that we are in snooze mode, alarm needs to go off again in a few minutes
+        
+        time_snooze = tod_add(tod_minute(time_get()), 9 * TOD_MINUTE); //Snooze to 9 minutes from now
+        alarm_resched = TRUE;
+        TRACE_EVENT(TR_SNOOZE, 0);
+    }
+
+    switch(ui_phase)
+    {
+        case UI_HELD:
+            if( (input_state & INPUT_BUTTONS) != 0 ) break;
+
+            input_flush(); //All released
+            ui_tap = 0;
+            ui_phase = UI_EDIT;
+            ui_blank = FALSE;
+            timer_stop(TIMER_UI); //ALARM SET blinks until here
+            break;
+
+        case UI_EDIT:
+            if(ui_mode == UI_TIME)
+            {
+                key = input_take(&input_press, INPUT_BUTTONS);
+                released = input_take(&input_release, (1<<BUT_UP)|(1<<BUT_DOWN));
+                held = input_take(&input_hold, INPUT_BUTTONS);
+                input_flush(); //Nothing else to do with the buttons here
+
+                //A tap of UP or DOWN on its own, not part of a hold: brighter or dimmer
+                if(key) ui_tap = ( (input_state & INPUT_BUTTONS & ~key) == 0 ) ? key & ((1<<BUT_UP)|(1<<BUT_DOWN)) : 0;
+                if(held) ui_tap = 0;
+                if(released & ui_tap)
+                {
+                    if(ui_tap & (1<<BUT_UP))
+                    {
+                        if(display_level < DISPLAY_LEVELS - 1) display_level_set(display_level + 1);
+                    }
+                    else if(display_level > 0) display_level_set(display_level - 1);
+                    ui_tap = 0;
+                }
+
+                if(held == ((1<<BUT_DOWN)|(1<<BUT_SNOOZE)))
+                    ui_enter(UI_CALIBRATE); //You've been holding down and snooze for a second
+#ifdef PROFILE
+                else if(held == ((1<<BUT_UP)|(1<<BUT_SNOOZE)))
+                    ui_enter(UI_DIAGNOSTICS); //You've been holding up and snooze for a second
+#endif
+#ifdef TRACE
+                else if(held == INPUT_BUTTONS)
+                    ui_enter(UI_TRACE); //You've been holding all three for a second
+#endif
+                else if(held == ((1<<BUT_UP)|(1<<BUT_DOWN)))
+                    ui_enter(UI_CLOCK_SET); //You've been holding up and down for a second
+                else if(held == (1<<BUT_SNOOZE))
+                    ui_enter(UI_ALARM_SET); //You've been holding snooze for a second
+                break;
+            }
+
+            if( input_take(&input_press, (1<<BUT_SNOOZE)) ) //All done!
+            {
+                ui_phase = UI_DONE;
+                ui_blinks = (ui_mode == UI_ALARM_SET) ? 8 : 6; //4 or 3 blinks
+                timer_start(TIMER_UI, UI_BLINK_MS, UI_BLINK_MS, ui_blink);
+                if(ui_mode == UI_CLOCK_SET) time_unsure = FALSE; //Set, or checked and left as it was
+#if defined(PROFILE) || defined(TRACE)
+                if(ui_mode == UI_DIAGNOSTICS || ui_mode == UI_TRACE)
+                {
+                    TRACE_EVENT(TR_MODE_OUT, ui_mode);
+                    ui_mode = UI_TIME; //No blinks
+                    ui_phase = UI_HELD;
+                    timer_stop(TIMER_UI);
+                }
+#endif
+                break;
+            }
+
+            key = input_take(&input_press, (1<<BUT_UP)|(1<<BUT_DOWN));
+            repeat = input_take(&input_repeat, (1<<BUT_UP)|(1<<BUT_DOWN));
+
+            if( (key | repeat) & (1<<BUT_UP) ) ui_adjust(TRUE, repeat & (1<<BUT_UP));
+            if( (key | repeat) & (1<<BUT_DOWN) ) ui_adjust(FALSE, repeat & (1<<BUT_DOWN));
+            break;
+    }
+
+    ui_display();
+}
+
+//Start a mode, its buttons are still down
+void ui_enter(uint8_t mode)
+{
+    TRACE_EVENT(TR_MODE_IN, mode);
+    ui_mode = mode;
+    ui_phase = UI_HELD;
+    ui_blank = (mode == UI_ALARM_SET); //Blinks, off first
+    if(mode == UI_ALARM_SET) timer_start(TIMER_UI, UI_BLINK_MS, UI_BLINK_MS, ui_blink);
+    ui_sling_shot = 0;
+    ui_step = 1;
+#if defined(PROFILE) || defined(TRACE)
+    ui_page = 0;
+#endif
+#ifdef TRACE
+    if(mode == UI_TRACE)
+    {
+        ui_trace_end = trace_count; //Pages count back from here
+        for(ui_trace_len = 0 ; ui_trace_len < TRACE_SIZE ; ui_trace_len++)
+            if(trace_buf[(uint8_t)(ui_trace_end - 1 - ui_trace_len) & (TRACE_SIZE - 1)].ev == TRACE_EMPTY) break;
+    }
+#endif
+}
+
+//TIMER_UI: blink ALARM SET while SNOOZE is held, and the value when it is done
+void ui_blink(void)
+{
+    ui_blank ^= 1;
+
+    if(ui_phase == UI_DONE && --ui_blinks == 0)
+    {
+        TRACE_EVENT(TR_MODE_OUT, ui_mode);
+        ui_mode = UI_TIME; //Back to the current time
+        ui_phase = UI_HELD;
+        ui_blank = FALSE;
+        timer_stop(TIMER_UI);
+    }
+}
+
+//UP or DOWN in a mode: step its value
+//The trim is used from the next second on, and check_persist() stores it.
+void ui_adjust(uint8_t up, uint8_t repeat)
+{
+    int16_t step;
+
+    switch(ui_mode)
+    {
+        case UI_CLOCK_SET:
+            step = ramp_next(&ui_sling_shot, &ui_step, repeat, 30);
+            time_adjust((up ? step : -step) * TOD_MINUTE);
+            break;
+
+        case UI_ALARM_SET:
+            step = ramp_next(&ui_sling_shot, &ui_step, repeat, 30);
+            alarm_set(0, tod_add(alarms[0].time, (up ? step : -step) * TOD_MINUTE), alarms[0].days);
+            break;
+
+        case UI_CALIBRATE:
+            step = clock_trim + (up ? 1 : -1) * ramp_next(&ui_sling_shot, &ui_step, repeat, 10);
+            if(step > TRIM_MAX) step = TRIM_MAX;
+            if(step < -TRIM_MAX) step = -TRIM_MAX;
+            trim_set(step);
+            break;
+
+#ifdef PROFILE
+        case UI_DIAGNOSTICS:
+            if(repeat) break; //A page a press
+            if(up)
+                ui_page = (ui_page == PROF_PAGES - 1) ? 0 : ui_page + 1;
+            else
+                ui_page = (ui_page == 0) ? PROF_PAGES - 1 : ui_page - 1;
+            break;
+#endif
+
+#ifdef TRACE
+        case UI_TRACE:
+            if(repeat || ui_trace_len == 0) break; //A page a press
+            if(up)
+                ui_page = (ui_page == 2 * ui_trace_len - 1) ? 0 : ui_page + 1;
+            else
+                ui_page = (ui_page == 0) ? 2 * ui_trace_len - 1 : ui_page - 1;
+            break;
+#endif
+    }
+}
+
+//Show what the mode is about, display_update() builds the frame
+//Calibration shows the trim in 0.1ppm.  A clock that gained 13s in 30 days without
+//trim runs 13 / (30 * 86400) = 5.0ppm fast: trim 50, one that lost time gets a 
+//minus trim.
+void ui_display(void)
+{
+    uint8_t source;
+
+    switch(ui_mode)
+    {
+        case UI_ALARM_SET:
+            source = SHOW_ALARM;
+            break;
+
+        case UI_CALIBRATE:
+            display_value = clock_trim;
+            source = SHOW_NUMBER;
+            break;
+
+#ifdef PROFILE
+        case UI_DIAGNOSTICS:
+            display_value = (ui_page + 1) * 1000 + diag_value(ui_page);
+            source = SHOW_NUMBER;
+            break;
+#endif
+
+#ifdef TRACE
+        case UI_TRACE:
+            source = trace_page(ui_page, &display_value) ? SHOW_NUMBER : SHOW_BLANK;
+            break;
+#endif
+
+        default: //UI_TIME, UI_CLOCK_SET
+            source = SHOW_TIME;
+            if( ui_mode == UI_TIME && ui_phase == UI_EDIT && (input_state & (1<<BUT_SNOOZE)) )
+                source = SHOW_ALARM; //Show the alarm time while SNOOZE is down
+            break;
+    }
+
+    if(ui_blank) source = SHOW_BLANK;
+    if(timer_running(TIMER_POWER_UP)) source = SHOW_TEST; //88:88 while the power up beep plays
+    display_source = source;
+}
+
+//Input events that came in since they were last taken, and clear them
+//ev is input_press, input_release, input_hold or input_repeat
+uint8_t input_take(volatile uint8_t *ev, uint8_t mask)
+{
+    uint8_t v;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        v = *ev & mask;
+        *ev &= ~v;
+    }
+
+    return(v);
+}
+
+//Forget all input events, e.g. the buttons that started a mode
+void input_flush(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        input_press = 0;
+        input_release = 0;
+        input_hold = 0;
+        input_repeat = 0;
+    }
+}
+
+//Step of a set mode: a press steps 1, every 6 repeats of a held button the 
+//step grows by one, up to max
+uint8_t ramp_next(uint8_t *sling_shot, uint8_t *step, uint8_t repeat, uint8_t max)
+{
+    if(!repeat)
+    {
+        *sling_shot = 0;
+        *step = 1;
+    }
+    else if(++*sling_shot > 5)
+    {
+        if(*step < max) (*step)++;
+        *sling_shot = 0;
+    }
+
+    return(*step);
+}
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+void clear_display(void)
+{
+    DISPLAY_AMPM_OFF();
+    PORTC = DISPLAY_PORTC_OFF;
+    PORTD = DISPLAY_PORTD_OFF;
+}
+
+//Segments of each glyph, with SEG_COL and SEG_AMPM for the lines the colon and 
+//the AM/PM dot share with the digits
+#define SEG_A       0x001
+#define SEG_B       0x002
+#define SEG_C       0x004
+#define SEG_D       0x008
+#define SEG_E       0x010
+#define SEG_F       0x020
+#define SEG_G       0x040
+#define SEG_DP      0x080
+#define SEG_COL     0x100
+#define SEG_AMPM    0x200
+
+#define GLYPH_SEGS_0    (SEG_A|SEG_B|SEG_C|SEG_D|SEG_E|SEG_F)
+#define GLYPH_SEGS_1    (SEG_B|SEG_C)
+#define GLYPH_SEGS_2    (SEG_A|SEG_B|SEG_D|SEG_E|SEG_G)
+#define GLYPH_SEGS_3    (SEG_A|SEG_B|SEG_C|SEG_D|SEG_G)
+#define GLYPH_SEGS_4    (SEG_B|SEG_C|SEG_F|SEG_G)
+#define GLYPH_SEGS_5    (SEG_A|SEG_C|SEG_D|SEG_F|SEG_G)
+#define GLYPH_SEGS_6    (SEG_A|SEG_C|SEG_D|SEG_E|SEG_F|SEG_G)
+#define GLYPH_SEGS_7    (SEG_A|SEG_B|SEG_C)
+#define GLYPH_SEGS_8    (SEG_A|SEG_B|SEG_C|SEG_D|SEG_E|SEG_F|SEG_G)
+#define GLYPH_SEGS_9    (SEG_A|SEG_B|SEG_C|SEG_D|SEG_F|SEG_G)
+#define GLYPH_SEGS_10   SEG_COL  //Colon
+#define GLYPH_SEGS_11   SEG_DP   //Alarm dot
+#define GLYPH_SEGS_12   SEG_AMPM //AM/PM dot
+#define GLYPH_SEGS_13   SEG_G    //Minus
+
+//Lines of a set of segments on one port (C or D) of the board
+#define GLYPH_LINES(segs, p) \
+    (((segs) & SEG_A ? SEG_A_##p : 0) | ((segs) & SEG_B ? SEG_B_##p : 0) | ((segs) & SEG_C ? SEG_C_##p : 0) | \
+     ((segs) & SEG_D ? SEG_D_##p : 0) | ((segs) & SEG_E ? SEG_E_##p : 0) | ((segs) & SEG_F ? SEG_F_##p : 0) | \
+     ((segs) & SEG_G ? SEG_G_##p : 0) | ((segs) & SEG_DP ? SEG_DP_##p : 0) | \
+     ((segs) & SEG_COL ? SEG_COL_##p : 0) | ((segs) & SEG_AMPM ? SEG_AMPM_##p : 0))
+
+//LEDs a set of segments lights, the colon is two
+#define GLYPH_LEDS(segs) \
+    (!!((segs) & SEG_A) + !!((segs) & SEG_B) + !!((segs) & SEG_C) + !!((segs) & SEG_D) + \
+     !!((segs) & SEG_E) + !!((segs) & SEG_F) + !!((segs) & SEG_G) + !!((segs) & SEG_DP) + \
+     2 * !!((segs) & SEG_COL) + !!((segs) & SEG_AMPM))
+
+//Port values with glyph n's segments on and the commons off, built by the compiler
+#define GLYPH(n) { DISPLAY_SEG_ON(DISPLAY_PORTC_OFF, GLYPH_LINES(GLYPH_SEGS_##n, C)), \
+                   DISPLAY_SEG_ON(DISPLAY_PORTD_OFF, GLYPH_LINES(GLYPH_SEGS_##n, D)) }
+
+//Glyph 0-9 are digits, 10 colon, 11 alarm dot, 12 AM/PM dot, 13 minus
+const uint8_t glyph_table[14][2] PROGMEM =
+{
+    //PORTC, PORTD
+    GLYPH(0), GLYPH(1), GLYPH(2), GLYPH(3), GLYPH(4), GLYPH(5), GLYPH(6), 
+    GLYPH(7), GLYPH(8), GLYPH(9), GLYPH(10), GLYPH(11), GLYPH(12), GLYPH(13)
+};
+
+//Common selected by each slot (AM/PM is on PORTB)
+const uint8_t slot_common[DISPLAY_SLOTS] PROGMEM =
+{
+#ifdef CONSOLE
+    0, 0, (1<<DIG_3), (1<<DIG_4), (1<<COL), (1<<DIG_4), 0 //DIG1/DIG2 pins are the console's RXD/TXD
+#else
+    (1<<DIG_1), (1<<DIG_2), (1<<DIG_3), (1<<DIG_4), (1<<COL), (1<<DIG_4), 0
+#endif
+};
+
+//On-time of a glyph lighting leds LEDs, at a level whose 8 is on for t counts
+//A lit segment's current goes through its cathode pin and the anode pin it shares 
+//with the rest of the digit.  The pins have about the same resistance R, so each 
+//of n segments gets V/(R + n*R): an 8 (7 LEDs) gets 2/8 of what a lone dot does.
+//Scaling the on-time by (1 + n)/(1 + DISPLAY_LEDS_MAX) evens that out.  Only the 8 
+//gets the whole on-time of the level, so no slot is on longer than DISPLAY_ON_US
+//and no digit pulls more anode current for longer than an 8 does.  Nothing is 
+//clamped to DISPLAY_ON_MIN, that would make a dot brighter than an 8 at night.
+#define GLYPH_ON(t, leds)   (((t) * (1 + (leds)) + DISPLAY_LEDS_MAX / 2) / (1 + DISPLAY_LEDS_MAX))
+
+#if GLYPH_ON(DISPLAY_DIM_TICKS, DISPLAY_LEDS_MIN) < DISPLAY_ON_MIN
+#error "A dot at the dimmest level would be on for less than DISPLAY_ON_MIN, raise DISPLAY_DIM_US"
+#endif
+
+//One level, in glyph_table order: digits 0-9, colon, alarm dot, AM/PM dot, minus
+#define GLYPH_ON_N(t, n)    GLYPH_ON(t, GLYPH_LEDS(GLYPH_SEGS_##n))
+#define GLYPH_ON_ROW(t) { GLYPH_ON_N(t, 0), GLYPH_ON_N(t, 1), GLYPH_ON_N(t, 2), GLYPH_ON_N(t, 3), GLYPH_ON_N(t, 4), \
+                          GLYPH_ON_N(t, 5), GLYPH_ON_N(t, 6), GLYPH_ON_N(t, 7), GLYPH_ON_N(t, 8), GLYPH_ON_N(t, 9), \
+                          GLYPH_ON_N(t, 10), GLYPH_ON_N(t, 11), GLYPH_ON_N(t, 12), GLYPH_ON_N(t, 13) }
+
+//On-time of each glyph at each brightness level in Timer2 counts, built by the compiler
+//The eye sees about (on-time)^(1/2.2), so the levels are even steps of that from 
+//the dimmest to the brightest, t = 30 * (0.548 + 0.0904 * level)^2.2.
+const uint8_t glyph_on_table[DISPLAY_LEVELS][14] PROGMEM =
+{
+    GLYPH_ON_ROW(DISPLAY_DIM_TICKS), //16us
+    GLYPH_ON_ROW(11), //22us
+    GLYPH_ON_ROW(15), //30us
+    GLYPH_ON_ROW(19), //38us
+    GLYPH_ON_ROW(24), //48us
+    GLYPH_ON_ROW(DISPLAY_ON_TICKS), //60us
+};
+
+//Change the brightness, display_update() builds a frame with it
+//Each slot gets the on-time of its glyph at the level (glyph_on_table[]), longer
+//the more LEDs it lights: an 8 gets the whole on-time of the level and a lone dot
+//2/8 of it.  The lit segments of a digit share the current of its common pin, so 
+//each of them gets less the more there are, and a 1 and an 8 only look as bright
+//with the 8 on for longer.  A dark slot gets DISPLAY_ON_MIN.  The frame has the 
+//same slots at every level, so the refresh costs the same whatever is shown.
+void display_level_set(uint8_t level)
+{
+    display_level = level;
+}
+
+//Build one slot of a frame from a glyph
+void display_glyph(display_slot_t *slot, uint8_t glyph, uint8_t n)
+{
+    if(glyph == BLANK)
+    {
+        slot->portc = DISPLAY_PORTC_OFF;
+        slot->portd = DISPLAY_PORTD_OFF;
+        slot->ampm = 0;
+        slot->on = DISPLAY_ON_MIN;
+        return;
+    }
+
+    slot->portc = pgm_read_byte(&glyph_table[glyph][0]);
+    slot->portd = DISPLAY_COM_ON(pgm_read_byte(&glyph_table[glyph][1]), pgm_read_byte(&slot_common[n]));
+    slot->ampm = (n == DISPLAY_SLOTS - 1);
+    slot->on = pgm_read_byte(&glyph_on_table[display_level][glyph]);
+}
+
+//Rebuild the frame when what is shown has changed and hand it to the multiplex engine
+//The division and table lookups happen here, once per change, instead of on every refresh
+//Returns TRUE when the frame being scanned is up to date
+uint8_t display_update(void)
+{
+    static uint8_t built[4] = {0xFF, 0xFF, 0xFF, 0xFF}; //What the last frame was built from
+    uint8_t state[4]; //hi, lo, flags, brightness
+    uint8_t hours, minutes, seconds, ampm;
+    uint8_t hi, lo, am, flip, neg, glyph[DISPLAY_SLOTS];
+    display_slot_t *frame;
+    tod_t now = time_get();
+
+    flip = now & 1; //Colon on every other second
+    tod_split(display_source == SHOW_ALARM ? alarms[0].time : now, &hours, &minutes, &seconds, &ampm);
+
+#ifdef NORMAL_TIME
+    hi = hours; //Display normal hh:mm time
+    lo = minutes;
+#else
+    hi = minutes; //During debug, display mm:ss
+    lo = seconds;
+    if(display_source == SHOW_ALARM) hi = hours, lo = minutes; //Alarm is always hh:mm
+#endif
+    am = (ampm == AM);
+
+    neg = FALSE;
+    if(display_source == SHOW_NUMBER)
+    {
+        neg = (display_value < 0);
+        hi = (uint16_t)(neg ? -display_value : display_value) / 100;
+        lo = (uint16_t)(neg ? -display_value : display_value) % 100;
+        flip = 0; //No colon
+        am = 0;
+    }
+
+    state[0] = hi;
+    state[1] = lo;
+    state[2] = display_source | (flip << 3) | (am << 4) | (neg << 6) | (time_unsure << 7);
+    if( (input_state & (1<<BUT_ALARM)) != 0) state[2] |= (1<<5);
+    state[3] = display_level;
+
+    if(memcmp(state, built, sizeof(state)) == 0)
+        return(frame_ready == FALSE); //Built, done once the ISR has swapped it in
+
+    if(frame_ready) return(FALSE); //Back buffer not swapped in yet, try again later
+
+    if(display_source == SHOW_BLANK)
+    {
+        memset(glyph, BLANK, sizeof(glyph));
+    }
+    else if(display_source == SHOW_TEST)
+    {
+        memset(glyph, 8, 4); //88:88 and every dot
+        glyph[4] = 10;
+        glyph[5] = 11;
+        glyph[6] = 12;
+    }
+    else
+    {
+        glyph[0] = hi / 10;
+#ifdef NORMAL_TIME
+        if(hi < 10) glyph[0] = BLANK; //No leading zero
+#endif
+        if(neg) glyph[0] = MINUS;
+        glyph[1] = hi % 10;
+        glyph[2] = lo / 10;
+        glyph[3] = lo % 10;
+        glyph[4] = (flip == 1) ? 10 : BLANK; //Flash colon for each second
+        glyph[5] = (display_source == SHOW_TIME && (state[2] & (1<<5))) ? 11 : BLANK; //Alarm on/off
+        glyph[6] = am ? 12 : BLANK; //Check whether it is AM or PM and turn on dot
+        if(display_source == SHOW_TIME && time_unsure && flip == 0)
+            memset(glyph, BLANK, 4); //Not set since the power came back: the time blinks with the colon
+    }
+
+    frame = frame_buffer[frame_back];
+    for(uint8_t i = 0 ; i < DISPLAY_SLOTS ; i++)
+        display_glyph(&frame[i], glyph[i], i);
+
+    memcpy(built, state, sizeof(state));
+    frame_ready = TRUE; //Swap
+
+    return(FALSE);
+}
+
+#ifdef PROFILE
+//Profiling timestamp in Timer0 counts (0.5us), 24 bits
+//An overflow not yet counted by TIMER0_OVF_vect shows as TOV0 with a small TCNT0.
+uint32_t prof_now(void)
+{
+    uint8_t lo;
+    uint16_t hi;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        lo = TCNT0;
+        hi = prof_t0_hi;
+        if( (TIFR0 & (1<<TOV0)) && lo < 128) hi++;
+    }
+
+    return( ((uint32_t)hi << 8) | lo );
+}
+
+//Diagnostics page (UI_DIAGNOSTICS), the display shows the page number first:
+// 1xxx CPU load of the last second in %
+// 2xxx worst TIMER2_COMPA_vect in us, 3xxx its mean in us
+// 4xxx worst TIMER2_COMPB_vect in us
+// 5xxx worst TIMER1_CAPT_vect in us
+// 6xxx worst main loop pass in ms, 7xxx its mean in us
+// 8xxx worst TIMER0_COMPA_vect (tone synthesizer) in us
+//Values over 999 show as 999.  The worst cases are since power up.
+uint16_t diag_value(uint8_t page)
+{
+    prof_stat_t s;
+    uint32_t v;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        switch(page)
+        {
+            case 0: v = prof_idle_last; break;
+            case 1: case 2: s = prof_compa; break;
+            case 3: s = prof_compb; break;
+            case 4: s = prof_capt; break;
+            case 7: s = prof_dds; break;
+            default: s = prof_loop; break;
+        }
+    }
+
+    if(page == 0)
+    {
+        v = v / (PROF_COUNTS_PER_SECOND / 100); //Idle %
+        v = (v < 100) ? 100 - v : 0;
+    }
+    else if(page == 2 || page == 6)
+        v = (s.count ? s.sum / s.count : 0) / 2; //Mean us
+    else if(page == 5)
+        v = s.max / 2000; //Worst ms
+    else
+        v = s.max / 2; //Worst us
+
+    if(v > 999) v = 999;
+    return(v);
+}
+#endif
+
+
+//Play a melody, once or over and over
+//With ramp it starts quiet and gets a step louder every ramp frames, else it is
+//loud from the start.  Returns at once, TIMER0_COMPA_vect makes the tone.
+void buzzer_start(const note_t *melody, uint8_t repeat, uint8_t ramp)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        buzz_melody = melody;
+        buzz_next = melody;
+        buzz_repeat = repeat;
+        buzz_volume = ramp ? DDS_DUTY_MIN : DDS_DUTY_MAX;
+        buzz_ramp = ramp;
+        buzz_ramp_count = ramp;
+        buzz_note();
+
+        OCR0A = TCNT0 + DDS_TICKS;
+        TIFR0 = (1<<OCF0A);
+        TIMSK0 |= (1<<OCIE0A);
+    }
+}
+
+//Start the next note, interrupts off
+//At the end of the melody it starts over or goes quiet.
+void buzz_note(void)
+{
+    uint8_t note, len;
+
+    note = pgm_read_byte(&buzz_next->note);
+    len = pgm_read_byte(&buzz_next->len);
+    if(len == 0 && buzz_repeat)
+    {
+        buzz_next = buzz_melody;
+        note = pgm_read_byte(&buzz_next->note);
+        len = pgm_read_byte(&buzz_next->len);
+    }
+
+    if(len == 0)
+    {
+        buzzer_stop();
+        return;
+    }
+
+    buzz_next++;
+    dds_step = pgm_read_word(&notes_step[note]);
+    dds_duty = (note == NOTE_REST) ? 0 : buzz_volume;
+    buzz_count = len;
+}
+
+//Silence the buzzer
+void buzzer_stop(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        TIMSK0 &= ~(1<<OCIE0A);
+        buzz_count = 0;
+        dds_duty = 0;
+        PORTB &= ~((1<<BUZZ1)|(1<<BUZZ2));
+    }
+}
+
+void ioinit(void)
+{
+    uint8_t flags, warm_ok;
+
+    flags = MCUSR; //What reset us, see warm_start()
+    MCUSR = 0;
+    wdt_disable(); //A watchdog reset leaves it on at the shortest timeout
+
+    //1 = output, 0 = input 
+    DDRB = 0b11111111 & ~((1<<BUT_UP)|(1<<BUT_DOWN)|(1<<BUT_ALARM)); //Up, Down, Alarm switch  
+    DDRC = 0b11111111;
+    DDRD = 0b11111111 & ~(1<<BUT_SNOOZE); //Snooze button
+    
+
+    PORTB = DISPLAY_PORTB_OFF; //Enable pull-ups on the buttons, display off
+    PORTD = DISPLAY_PORTD_OFF; //Enable pull-up on snooze button
+    PORTC = DISPLAY_PORTC_OFF;
+
+    //Init Timer0 for the tone synthesizer, free running
+    TCCR0B = (1<<CS01); //Set Prescaler to clk/8 : 1click = 0.5us(assume we are running at external 16MHz). CS01=1 
+#ifdef PROFILE
+    TIMSK0 = (1<<TOIE0); //Count overflows for prof_now()
+#endif
+    
+    //Init Timer1 for second counting <mds> CTC mode
+    TCCR1B = (1<<CS12)|(1<<CS10); //Set prescaler to clk/1024 :1click = 64us (assume we are running at 16MHz)
+    //<mds> set CTC mode
+    TCCR1B |= (1<<WGM12)|(1<<WGM13); // Mode 12 CTC mode
+    TIMSK1 = (1<<ICIE1)|(1<<OCIE1B); //Enable capture (time) and compare B (trim) interrupts
+    ICR1 = TIMER1_TOP; // SET TOP to 1s
+    OCR1B = TIMER1_TOP / 2; //Trim half way through the second
+    trim_set(0); //Until persist_load()
+    warm_ok = warm_start(flags); //Picks up the uptime and the phase of the second
+#ifdef TRACE
+    trace_start(flags);
+#endif
+    //TCNT1 = 49911; //65536 - 15,625 = 49,911 - Preload timer 1 for 49,911 clicks. Should be 1s per ISR call
+    
+    //Init Timer2 for the display multiplex engine
+    TCCR2A = (1<<WGM21); //Mode 2 CTC mode, TOP = OCR2A
+    TCCR2B = (1<<CS21)|(1<<CS20); //Set prescalar to clk/32 : 1 click = 2us (assume 16MHz)
+    OCR2A = DISPLAY_SLOT_TICKS - 1; //Next slot every DISPLAY_SLOT_US
+    OCR2B = DISPLAY_ON_MIN; //Slot off after its on-time, TIMER2_COMPA_vect sets it for each slot
+    TIMSK2 = (1<<OCIE2A)|(1<<OCIE2B);
+
+    //Inputs as they are at power up, no events for them
+    input_state = ((PINB & INPUT_PINB) | (PIND & INPUT_PIND)) ^ INPUT_BUTTONS;
+
+    //Sleep between events.  Timer1/Timer2 run from the I/O clock, so only idle keeps time
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    ACSR = (1<<ACD); //Analog comparator off
+#ifdef CONSOLE
+    PRR = (1<<PRTWI)|(1<<PRSPI)|(1<<PRADC); //Unused peripherals off, USART0 is the console
+    console_init();
+#else
+    PRR = (1<<PRTWI)|(1<<PRSPI)|(1<<PRUSART0)|(1<<PRADC); //Unused peripherals off
+#endif
+    
+    display_source = warm_ok ? SHOW_BLANK : SHOW_TEST;
+
+    alarm_going = FALSE;
+    
+    display_update(); //88:88 during the power up beep
+    
+    sei(); //Enable interrupts
+
+    if(!warm_ok)
+    {
+        buzzer_start(power_up_melody, FALSE, 0); //Make some noise at power up
+        timer_start(TIMER_POWER_UP, POWER_UP_MS, 0, NULL); //Show 88:88 while it beeps
+    }
+    
+    time_set(tod_make(12, 00, 00, AM));
+    alarm_set(0, tod_make(11, 55, 00, PM), ALARM_DAYS); //Every day, the others off
+    time_snooze = TOD_NEVER;
+    snooze = FALSE;
+    persist_load(); //What was saved before the power went, over the defaults
+    time_unsure = TRUE; //12:00 AM or up to PERSIST_CHECKPOINT minutes and the power cut behind
+    if(warm_ok) warm_restore(); //What there was before the reset, over that
+
+#ifdef WATCHDOG
+    timer_start(TIMER_WATCHDOG, WATCHDOG_FEED_MS, WATCHDOG_FEED_MS, NULL);
+    wdt_enable(WDTO_500MS);
+#endif
+}
+
+//Time of day arithmetic
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//A time of day is seconds since midnight, so stepping, comparing and wrapping 
+//are single 32-bit operations.  Cycle counts are estimates of the avr-gcc -Os 
+//code at 16MHz, not measured.
+
+//Add delta seconds (-TOD_DAY < delta < TOD_DAY), wrapping around midnight
+//~25 cycles: one add, one sign test and at most one add/subtract of TOD_DAY
+tod_t tod_add(tod_t t, int32_t delta)
+{
+    t += delta;
+    if((int32_t)t < 0)
+        t += TOD_DAY;
+    else if(t >= TOD_DAY)
+        t -= TOD_DAY;
+
+    return(t);
+}
+
+//Seconds from 'from' forward to 'to', 0..TOD_DAY-1
+//~30 cycles
+tod_t tod_until(tod_t from, tod_t to)
+{
+    return(tod_add(to, -(int32_t)from));
+}
+
+//Start of the minute
+//~220 cycles: t/60 == (t/4)/15 fits a 16-bit divide since t/4 < 21600
+tod_t tod_minute(tod_t t)
+{
+    return((uint16_t)(t >> 2) / 15 * TOD_MINUTE);
+}
+
+//Build a time of day from 12-hour clock fields
+//~60 cycles
+tod_t tod_make(uint8_t hours, uint8_t minutes, uint8_t seconds, uint8_t ampm)
+{
+    if(hours == 12) hours = 0; //12:xx AM is 00:xx
+    if(ampm == PM) hours += 12;
+
+    return((uint16_t)(hours * 60 + minutes) * TOD_MINUTE + seconds);
+}
+
+//Split a time of day into 12-hour clock fields for display
+//~450 cycles: two 16-bit divides, the rest is subtract and compare
+void tod_split(tod_t t, uint8_t *hours, uint8_t *minutes, uint8_t *seconds, uint8_t *ampm)
+{
+    uint16_t m = (uint16_t)(t >> 2) / 15; //Minute of the day
+    uint8_t h = m / 60;
+
+    *seconds = (uint8_t)t - (uint8_t)(m * 60); //Exact, the difference is < 60
+    *minutes = m - h * 60;
+    *ampm = AM;
+    if(h >= 12)
+    {
+        h -= 12;
+        *ampm = PM;
+    }
+    if(h == 0) h = 12;
+    *hours = h;
+}
+
+//Consistent copy of the current time, without disabling interrupts
+//TIMER1_CAPT_vect is the only writer and bumps time_gen after each update, so 
+//if time_gen is unchanged after the copy, no tick happened in the middle of it.
+tod_t time_get(void)
+{
+    uint8_t gen;
+    tod_t t;
+
+    do
+    {
+        gen = time_gen;
+        t = time_now;
+    } while(gen != time_gen);
+
+    return(t);
+}
+
+//Seconds since power-up, and the phase within the second in Timer1 counts (64us)
+//A monotonic timestamp, see uptime_read()
+uint32_t uptime_get(uint16_t *phase)
+{
+    uint32_t s;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        s = uptime_read(phase);
+    }
+
+    return(s);
+}
+
+//Consistent copy of the current time and the day of the week
+tod_t time_get_day(uint8_t *wday)
+{
+    uint8_t gen;
+    tod_t t;
+
+    do
+    {
+        gen = time_gen;
+        t = time_now;
+        *wday = time_wday;
+    } while(gen != time_gen);
+
+    return(t);
+}
+
+//Consistent copy of the current time, the day of the week and the uptime second
+tod_t time_get_tick(uint8_t *wday, uint32_t *up)
+{
+    tod_t t;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        t = time_now;
+        *wday = time_wday;
+        *up = uptime_sec;
+    }
+
+    return(t);
+}
+
+//Move the current time by delta seconds (set mode)
+//The read-modify-write is a few cycles with interrupts off, a tick that comes in
+//meanwhile is held by the timer and counted right after, so none is lost.
+void time_adjust(int32_t delta)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        time_now = tod_add(time_now, delta);
+        time_gen++;
+    }
+    time_unsure = FALSE;
+    persist_time_moved = TRUE;
+    alarm_resched = TRUE;
+}
+
+//Set the current time, the phase of the running second is kept
+void time_set(tod_t t)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        time_now = t;
+        time_gen++;
+    }
+    time_unsure = FALSE;
+    persist_time_moved = TRUE;
+    alarm_resched = TRUE;
+}
+
+//Set the day of the week, 0 is Sunday
+void time_set_wday(uint8_t wday)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        time_wday = wday;
+        time_gen++;
+    }
+    persist_time_moved = TRUE;
+    alarm_resched = TRUE;
+}
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//Alarm schedule
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//Each alarm is a time of day and the days of the week it goes off on.  A one-shot
+//(ALARM_ONCE) goes off on the first of its days that comes, then its days are 
+//cleared.  Rather than looking at every alarm every second, alarm_schedule() 
+//works out the next one (alarm_due, alarm_due_day) when something changed and 
+//check_alarm() compares the time with that.  A snooze stands in for the alarms 
+//until it runs out.
+
+//Set alarm n, on the minute.  An alarm that is off comes back on for every day,
+//a one-shot stays one.
+void alarm_set(uint8_t n, tod_t t, uint8_t days)
+{
+    if( (days & ALARM_DAYS) == 0 ) days |= ALARM_DAYS;
+
+    alarms[n].time = tod_minute(t);
+    alarms[n].days = days;
+    alarm_resched = TRUE;
+}
+
+//Find the next alarm after now (or the snooze), ~100 cycles an alarm
+//Days ahead and time of day are compared as a pair, so there is no 32-bit multiply
+//but the one for alarm_due_up, the uptime second it is due in counted from up.
+void alarm_schedule(tod_t now, uint8_t wday, uint32_t up)
+{
+    uint8_t best_d = WEEK_DAYS + 1, d, day;
+    tod_t best_t = TOD_NEVER;
+
+    alarm_resched = FALSE;
+
+    if(snooze)
+    {
+        best_d = (time_snooze <= now); //Tomorrow when it is past midnight
+        best_t = time_snooze;
+    }
+    else
+    {
+        for(uint8_t i = 0 ; i < ALARMS ; i++)
+        {
+            if( (alarms[i].days & ALARM_DAYS) == 0 ) continue; //Off
+
+            //Today if it is still to come, else from tomorrow on, up to the same day next week
+            d = (alarms[i].time <= now);
+            day = wday + d;
+            if(day == WEEK_DAYS) day = 0;
+            while( (alarms[i].days & (1 << day)) == 0 )
+            {
+                d++;
+                if(++day == WEEK_DAYS) day = 0;
+            }
+
+            if(d < best_d || (d == best_d && alarms[i].time < best_t))
+            {
+                best_d = d;
+                best_t = alarms[i].time;
+            }
+        }
+    }
+
+    alarm_due = best_t;
+    day = wday + best_d;
+    while(day >= WEEK_DAYS) day -= WEEK_DAYS;
+    alarm_due_day = day;
+    if(best_t != TOD_NEVER) alarm_due_up = up + best_d * TOD_DAY + best_t - now;
+}
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//Crystal trim
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//Trim in 0.1ppm, + when the crystal runs fast.  A second is 15625 * (1 + trim) 
+//Timer1 counts: trim / TRIM_STEP whole counts go into ICR1, the rest is the 
+//fraction TIMER1_COMPB_vect adds up.  It is used from the next half second on.
+void trim_set(int16_t trim)
+{
+    int16_t whole = trim / TRIM_STEP;
+    int16_t frac = trim % TRIM_STEP;
+
+    if(frac < 0) //Round down, the fraction is always added
+    {
+        frac += TRIM_STEP;
+        whole--;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        clock_trim = trim;
+        trim_top = TIMER1_TOP + whole;
+        trim_frac = frac;
+    }
+}
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//Persistence
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//The alarms, the snooze, the crystal trim, the brightness and a checkpoint of the 
+//time and day are kept in a ring of PERSIST_RECORDS records in EEPROM.  Each save
+//goes into the next slot with the next sequence number, so a cell is only written 
+//once per trip around the ring: a checkpoint every 10 minutes is 144 records a day,
+//3.4 writes a cell, 80 years of the 100,000 a cell is good for.  A record cut short by a power 
+//failure fails its CRC and the one before it is used.
+
+//CRC-8 of a record without its crc byte.  Starting at 0xFF, neither an erased 
+//(0xFF) nor a cleared record is a good one.
+uint8_t persist_crc(const persist_t *r)
+{
+    const uint8_t *p = (const uint8_t *)r;
+    uint8_t crc = 0xFF;
+
+    for(uint8_t i = 0 ; i < offsetof(persist_t, crc) ; i++)
+        crc = _crc8_ccitt_update(crc, p[i]);
+
+    return(crc);
+}
 
-        display_number(minutes % 10, 4); //Post to digit 4
-        delay_us(bright_level);
-#else
-        //During debug, display mm:ss
-        display_number(minutes / 10, 1); 
-        delay_us(bright_level);
+//The state as a record, with the time of now.  No seq or crc yet
+void persist_get(persist_t *r, tod_t now)
+{
+    memset(r, 0, sizeof(persist_t));
+    for(uint8_t i = 0 ; i < ALARMS ; i++)
+    {
+        r->alarm[i] = (uint16_t)(alarms[i].time >> 2) / 15;
+        r->days[i] = alarms[i].days;
+    }
+    r->wday = time_wday;
+    r->time = (uint16_t)(now >> 2) / 15; //Minute of the day
+    r->snooze = snooze ? (uint16_t)(time_snooze >> 2) / 15 : PERSIST_NO_SNOOZE;
+    r->trim = clock_trim;
+    r->bright = display_level;
+    r->zone = sync_zone;
+}
 
-        display_number(minutes % 10, 2); 
-        delay_us(bright_level);
+//Restore from the newest good record, at power up.  FALSE if there is none and
+//the defaults stay.  Reads the whole ring, 1008 bytes in ~1ms.
+//The ring has fewer than 128 records, so the sequence numbers in it are less 
+//than 128 apart and their signed difference orders them across the wrap.
+uint8_t persist_load(void)
+{
+    persist_t r;
+    uint8_t found = FALSE;
 
-        display_number(seconds / 10, 3); 
-        delay_us(bright_level);
+    for(uint8_t slot = 0 ; slot < PERSIST_RECORDS ; slot++)
+    {
+        eeprom_read_block(&r, (const void *)(slot * sizeof(persist_t)), sizeof(persist_t));
 
-        display_number(seconds % 10, 4); 
-        delay_us(bright_level);
-#endif
-        
-        //Flash colon for each second
-        if(flip == 1) 
-        {
-            display_number(10, 5); //Post to digit COL
-            delay_us(bright_level);
-        }
-        
-        //Indicate wether the alarm is on or off
-        if( (PINB & (1<<BUT_ALARM)) != 0)
-        {
-            display_number(11, 4); //Turn on dot on digit 4
-            delay_us(bright_level);
+        if(r.crc != persist_crc(&r)) continue; //Erased or cut short
+        if(found && (int8_t)(r.seq - persist_rec.seq) <= 0) continue; //Older
 
-            //If the alarm slide is on, and alarm_going is true, make noise!
-            if(alarm_going == TRUE && flip_alarm == 1)
-            {
-                clear_display();
-                siren(500);
-                flip_alarm = 0;
-            }
+        persist_rec = r;
+        persist_slot = slot;
+        found = TRUE;
+    }
+
+    if(found)
+    {
+        trim_set(persist_rec.trim);
+        if(persist_rec.bright < DISPLAY_LEVELS) display_level_set(persist_rec.bright);
+        if(persist_rec.zone >= -SYNC_ZONE_MAX && persist_rec.zone <= SYNC_ZONE_MAX) sync_zone = persist_rec.zone;
+        time_set(persist_rec.time * TOD_MINUTE);
+        if(persist_rec.wday < WEEK_DAYS) time_set_wday(persist_rec.wday);
+        for(uint8_t i = 0 ; i < ALARMS ; i++)
+        {
+            alarms[i].time = persist_rec.alarm[i] * TOD_MINUTE;
+            alarms[i].days = persist_rec.days[i];
         }
-        else
+        if(persist_rec.snooze != PERSIST_NO_SNOOZE)
         {
-            snooze = FALSE; //If the alarm switch is turned off, this resets the ~9 minute addtional snooze timer
-            
-            hours_alarm_snooze = 88; //Set these values high, so that normal time cannot hit the snooze time accidentally
-            minutes_alarm_snooze = 88;
-            seconds_alarm_snooze = 88;
+            snooze = TRUE;
+            time_snooze = persist_rec.snooze * TOD_MINUTE;
         }
-        
-        //Check whether it is AM or PM and turn on dot
-        if(ampm == AM)
+    }
+    else
+    {
+        persist_get(&persist_rec, time_get()); //The defaults count as saved
+        persist_rec.seq = 0xFF; //The first record is 0, in slot 0
+        persist_slot = PERSIST_RECORDS - 1;
+    }
+
+    persist_want = persist_rec;
+    persist_time_moved = FALSE;
+
+    return(found);
+}
+
+//Save the state to EEPROM when it changed, from the main loop
+//A change is written once it stood for PERSIST_SETTLE seconds, so stepping the
+//alarm in ALARM SET or the trim in calibration mode is one record, not one per 
+//step.  The time is saved every PERSIST_CHECKPOINT minutes and after it was set.
+//EE_READY_vect writes the record a byte per interrupt, this never waits for it.
+void check_persist(void)
+{
+    persist_t r;
+    tod_t now;
+
+    if(EECR & (1<<EERIE)) return; //Still writing the last one
+
+    now = time_get();
+    persist_get(&r, now);
+    if(!persist_time_moved && r.time % PERSIST_CHECKPOINT != 0)
+        r.time = persist_rec.time; //No checkpoint due
+
+    if(memcmp(&r, &persist_want, offsetof(persist_t, seq)) != 0)
+    {
+        persist_want = r; //Changed, wait for it to settle
+        persist_since = now;
+        return;
+    }
+    if(memcmp(&r, &persist_rec, offsetof(persist_t, seq)) == 0) return; //Saved
+    if(tod_until(persist_since, now) < PERSIST_SETTLE) return;
+
+    r.seq = persist_rec.seq + 1;
+    r.crc = persist_crc(&r);
+    persist_rec = r;
+    if(++persist_slot == PERSIST_RECORDS) persist_slot = 0;
+    persist_time_moved = FALSE;
+
+    persist_left = sizeof(persist_t);
+    EECR |= (1<<EERIE); //EE_READY_vect takes it from here
+}
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//Warm restart
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//A reset that is not a power up (watchdog, brown-out, the reset pin) leaves the 
+//RAM as it was, so the clock picks up where it left off instead of at 12:00 AM
+//or the last EEPROM checkpoint, with no beep or 88:88.  The main loop keeps a 
+//snapshot of the state (warm) up to date, and every frame the multiplex engine
+//notes the uptime and the phase of the second (warm_sec, warm_phase), all in 
+//.noinit.  The time comes back from the snapshot plus the seconds counted since,
+//and the second from the frame stamp, late by about a millisecond.
+
+//CRC-8 of a snapshot without its crc byte
+uint8_t warm_crc(const warm_t *w)
+{
+    const uint8_t *p = (const uint8_t *)w;
+    uint8_t crc = 0xFF;
+
+    for(uint8_t i = 0 ; i < offsetof(warm_t, crc) ; i++)
+        crc = _crc8_ccitt_update(crc, p[i]);
+
+    return(crc);
+}
+
+//Right after a reset with MCUSR in flags, Timer1 set up and stopped interrupts:
+//TRUE if it was a warm one with a good snapshot.  Then uptime_sec and TCNT1 go on 
+//from the frame stamp, warm_restore() does the rest once the defaults are in.
+uint8_t warm_start(uint8_t flags)
+{
+    uint32_t sec = warm_sec;
+    uint16_t phase = warm_phase;
+
+    if( (flags & (1<<PORF)) || (flags & ((1<<WDRF)|(1<<BORF)|(1<<EXTRF))) == 0 ) return(FALSE); //RAM is random
+    if( warm.magic != WARM_MAGIC || warm.crc != warm_crc(&warm) ) return(FALSE);
+    if( sec - warm.uptime > WARM_STALE || phase > TIMER1_TOP + 2 ) return(FALSE);
+
+    phase += WARM_LATE;
+    if(phase > TIMER1_TOP)
+    {
+        phase -= TIMER1_TOP + 1;
+        sec++;
+    }
+    uptime_sec = sec;
+    TCNT1 = phase;
+
+    return(TRUE);
+}
+
+//The state of the snapshot, over the defaults and what persist_load() found.  The
+//time moves on by the seconds uptime_sec counted since the snapshot, also the ones
+//since warm_start().  The alarm schedule is in uptime seconds too, so an alarm 
+//that came due during the reset goes off, late.  check_persist() saves what the 
+//EEPROM did not have yet.
+void warm_restore(void)
+{
+    uint8_t wday = warm.wday;
+    tod_t t;
+
+    trim_set(warm.trim);
+    display_level_set(warm.bright);
+    time_unsure = warm.unsure;
+    for(uint8_t i = 0 ; i < ALARMS ; i++) alarms[i] = warm.alarms[i];
+    snooze = warm.snooze;
+    time_snooze = warm.snooze_time;
+    alarm_going = warm.going;
+    alarm_due = warm.due;
+    alarm_due_day = warm.due_day;
+    alarm_due_up = warm.due_up;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        t = warm.time + (uptime_sec - warm.uptime);
+        while(t >= TOD_DAY)
         {
-            display_number(12, 6); //Turn on dot on apostrophe
-            delay_us(bright_level);
+            t -= TOD_DAY;
+            if(++wday == WEEK_DAYS) wday = 0;
         }
+        time_now = t;
+        time_wday = wday;
+        time_gen++;
+    }
+    alarm_resched = warm.resched;
+}
 
-        clear_display();
-        delay_us(bright_level);
+//Keep the snapshot up to date, from the main loop
+//It is only written, and its CRC worked out, when the state changed: once a 
+//second for the time.  A reset while it is being written leaves a bad CRC, and 
+//the restart is a cold one with what the EEPROM has.
+void check_warm(void)
+{
+    warm_t w;
+
+    memset(&w, 0, sizeof(warm_t)); //Padding on the host
+    w.magic = WARM_MAGIC;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        w.uptime = uptime_sec;
+        w.time = time_now;
+        w.wday = time_wday;
     }
+    for(uint8_t i = 0 ; i < ALARMS ; i++) w.alarms[i] = alarms[i];
+    w.snooze = snooze;
+    w.snooze_time = time_snooze;
+    w.going = alarm_going;
+    w.due = alarm_due;
+    w.due_day = alarm_due_day;
+    w.due_up = alarm_due_up;
+    w.resched = alarm_resched;
+    w.trim = clock_trim;
+    w.bright = display_level;
+    w.unsure = time_unsure;
+
+    if(memcmp(&w, &warm, offsetof(warm_t, crc)) == 0) return; //Up to date
+
+    w.crc = warm_crc(&w);
+    warm = w;
 }
 
-//Displays current alarm time
-//Brightness level is an amount of time the LEDs will be in - 200us is pretty dim but visible.
-//Amount of time during display is around : [ BRIGHT_LEVEL(us) * 5 + 10ms ] * 10
-//Roughly 11ms * 10 = 110ms
-//Time on is in (ms)
-void display_alarm_time(uint16_t time_on)
+#ifdef TRACE
+//Start the event trace after a reset, with MCUSR in flags
+//A warm restart (see warm_start()) goes on with the ring as it was, so the 
+//events before the reset are still there.  At power-up the RAM is random and 
+//the ring is cleared.
+void trace_start(uint8_t flags)
 {
-    uint16_t bright_level = 50;
-    
-    //time_on /= 11; //Take the time_on and adjust it for the time it takes to run the display loop below
+    if( (flags & (1<<PORF)) || (flags & ((1<<WDRF)|(1<<BORF)|(1<<EXTRF))) == 0 || trace_magic != TRACE_MAGIC )
+    {
+        memset(trace_buf, TRACE_EMPTY, sizeof(trace_buf));
+        trace_count = 0;
+        trace_magic = TRACE_MAGIC;
+    }
+
+    trace(TR_RESET, flags);
+}
+
+//Trace page (UI_TRACE), two an event, from the newest when the mode was entered
+//back.  UP steps back in time, DOWN forward:
+// nxxx event n, TR_* + 1 (its place in TR_LETTERS), and its arg
+//  xxx ms into the second it was recorded at, from its TCNT1 stamp
+//Returns FALSE if the event was written over since, the page is blank, or for an 
+//empty ring.
+uint8_t trace_page(uint8_t page, int16_t *value)
+{
+    uint8_t seq = ui_trace_end - 1 - page / 2;
+    uint8_t count;
+    trace_t e;
+
+    if(ui_trace_len == 0) return(FALSE);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        e = trace_buf[seq & (TRACE_SIZE - 1)];
+        count = trace_count;
+    }
+    if( (uint8_t)(count - seq) > TRACE_SIZE ) return(FALSE);
+
+    if(page & 1)
+        *value = (uint32_t)e.phase * 64 / 1000;
+    else
+        *value = (e.ev + 1) * 1000 + e.arg;
+    return(TRUE);
+}
+
+#ifdef CONSOLE
+//Send TRACE_LINE events of the trace from number seq on, oldest first, or from
+//the oldest still in the ring if seq is older than that or all is set.  The 
+//reply starts with the number of the event after them, to ask for next.  The
+//numbers are trace_count's and wrap at 256.
+//An event is copied with interrupts off, and one that was written over while 
+//the reply went out is left out.
+void trace_dump(uint8_t seq, uint8_t all)
+{
+    uint8_t count, n;
+    trace_t e;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        count = trace_count;
+    }
+    if( all || (uint8_t)(count - seq) > TRACE_SIZE ) seq = count - TRACE_SIZE;
+    while( seq != count && trace_buf[seq & (TRACE_SIZE - 1)].ev == TRACE_EMPTY ) seq++; //Not written since power-up
+    n = count - seq;
+    if(n > TRACE_LINE) n = TRACE_LINE;
 
-    for(uint16_t j = 0 ; j < time_on ; j++)
+    console_put_number((uint8_t)(seq + n));
+    for( ; n != 0 ; n--, seq++)
     {
-        //Display normal hh:mm time
-        if(hours_alarm > 9)
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
         {
-            display_number(hours_alarm / 10, 1); //Post to digit 1
-            delay_us(bright_level);
+            e = trace_buf[seq & (TRACE_SIZE - 1)];
+            count = trace_count;
         }
+        if( (uint8_t)(count - seq) > TRACE_SIZE || e.ev == TRACE_EMPTY ) continue;
+
+        console_putc(' ');
+        console_putc(e.ev < sizeof(TR_LETTERS) - 1 ? TR_LETTERS[e.ev] : '?');
+        console_putc(':');
+        console_put_number(e.arg);
+        console_putc(':');
+        console_put_number(e.phase);
+    }
+}
+#endif
+#endif
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 
-        display_number(hours_alarm % 10, 2); //Post to digit 2
-        delay_us(bright_level);
+//Soft timers
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//Everything that waits does it with one of TIMERS soft timers instead of a 
+//busy-wait, and main sleeps meanwhile.  They count display frames (2.1ms) of
+//timer_ticks.  timer_arm() finds the one that runs out first, so the multiplex
+//engine does one compare a frame however many are on, and check_timers() calls 
+//their functions from the main loop, never from the interrupt.
+
+//Start timer id: it runs out in ms, then every period_ms (0: only once), and 
+//calls fn each time.  Starting it again restarts it.
+void timer_start(uint8_t id, uint16_t ms, uint16_t period_ms, void (*fn)(void))
+{
+    soft_timer_t *tm = &timers[id];
+    uint16_t now;
 
-        display_number(minutes_alarm / 10, 3); //Post to digit 3
-        delay_us(bright_level);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        now = timer_ticks;
+    }
 
-        display_number(minutes_alarm % 10, 4); //Post to digit 4
-        delay_us(bright_level);
+    tm->due = now + FRAME_TICKS(ms);
+    tm->period = FRAME_TICKS(period_ms);
+    tm->fn = fn;
+    tm->on = TRUE;
+    hal_frames(ms);
 
-        
-        //During debug, display mm:ss
-        /*display_number(minutes_alarm / 10, 1); 
-        delay_us(bright_level);
+    timer_arm();
+}
 
-        display_number(minutes_alarm % 10, 2); 
-        delay_us(bright_level);
+void timer_stop(uint8_t id)
+{
+    timers[id].on = FALSE;
+    timer_arm();
+}
 
-        display_number(seconds_alarm / 10, 3); 
-        delay_us(bright_level);
+//TRUE until a one-shot or deadline has run out, or while a periodic one is on
+uint8_t timer_running(uint8_t id)
+{
+    return(timers[id].on);
+}
 
-        display_number(seconds_alarm % 10, 4); 
-        delay_us(bright_level);
+//Tell TIMER2_COMPB_vect when the first timer is due
+//Due times are compared as differences, so timer_ticks may wrap.  One that is 
+//already due is posted right away, the interrupt only sees timer_next go by.
+void timer_arm(void)
+{
+    int16_t left, first = INT16_MAX;
+    uint8_t armed = FALSE;
 
-        display_number(10, 5); //Display colon
-        delay_us(bright_level);*/
-        
-        //Flash colon for each second
-        if(flip == 1) 
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        for(uint8_t i = 0 ; i < TIMERS ; i++)
         {
-            display_number(10, 5); //Post to digit COL
-            delay_us(bright_level);
+            if(!timers[i].on) continue;
+
+            left = timers[i].due - timer_ticks;
+            if(left < first) first = left;
+            armed = TRUE;
         }
-        
-        //Check whether it is AM or PM and turn on dot
-        if(ampm_alarm == AM)
-        {   
-            display_number(12, 6); //Turn on dot on apostrophe
-            delay_us(bright_level);
+
+        timer_next = timer_ticks + first;
+        timer_armed = armed;
+        if(armed && first <= 0) events |= EV_TIMER;
+    }
+}
+
+//Run the timers that are due, from the main loop
+//A periodic timer keeps its phase: if main was late it runs again right away.
+void check_timers(void)
+{
+    soft_timer_t *tm;
+    uint16_t now;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        now = timer_ticks;
+    }
+
+    for(uint8_t i = 0 ; i < TIMERS ; i++)
+    {
+        tm = &timers[i];
+        if(!tm->on || (int16_t)(now - tm->due) < 0) continue;
+
+        if(tm->period != 0)
+        {
+            tm->due += tm->period;
+            hal_frames(FRAME_MS(tm->period));
         }
+        else
+            tm->on = FALSE;
 
-        clear_display();
-        delay_ms(1);
+        if(tm->fn != NULL) tm->fn(); //May start or stop timers
     }
-    
+
+    timer_arm();
+}
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+#ifdef CONSOLE
+//Serial console
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//One command per line, or several separated by ';' with the replies on one line
+//separated by ';', so a test fixture sets up a unit in one round trip:
+//  t               -> t hh:mm:ss   Current time
+//  t hh:mm[:ss]    -> t hh:mm:ss   Set the time
+//  a               -> a hh:mm:ss   Alarm time (the first alarm)
+//  a hh:mm         -> a hh:mm:ss   Set the alarm
+//  a<n>            -> a<n> hh:mm:ss <days>  Alarm n, 0..ALARMS-1
+//  a<n> hh:mm [<days>]   -> a<n> ...   Set it, the days are SMTWTFS with - for a day
+//                  off and a trailing ! for a one-shot: -MTWTF- weekdays, ------- off
+//  d               -> d <day>      Day of the week, 0 is Sunday
+//  d <day>         -> d <day>      Set it
+//  n               -> n <day> hh:mm:ss  Next alarm or snooze due, n - if none
+//  s               -> s <time> <due> <switch> <going> <snooze> <awake %>  The due
+//                  time is the next alarm or snooze as with n, - if none is on
+//  c               -> c <trim>     Crystal trim in 0.1ppm (see ui_display())
+//  c <trim>        -> c <trim>     Set it and store it in EEPROM
+//  b               -> b <level>    Brightness, 0 (dimmest) to DISPLAY_LEVELS - 1
+//  b <level>       -> b <level>    Set it and store it in EEPROM
+//  u               -> u <seconds> <phase>  Uptime, and the 64us counts into the second
+//  l               -> l <fired> <late> <worst>  Alarms and snoozes that came due, how
+//                  late the last one and the worst one went off, in ms
+//  y               -> y <synced> <bad> <offset>  Time sync lines applied, lines with a
+//                  bad checksum or time, how far off the clock was at the last one in
+//                  ms, + if it was slow
+//  z               -> z <minutes>  UTC offset of the NMEA time sync lines
+//  z <minutes>     -> z <minutes>  Set it and store it in EEPROM
+//  e               -> e <next> <event>...  The oldest TRACE_LINE events of the trace
+//                  (TRACE), each <letter>:<arg>:<TCNT1>, the letters are TR_LETTERS
+//  e <next>        -> e <next> <event>...  The ones after those, none once caught up
+//Times are 24-hour.  Anything else gets ?, and so does a line that lost bytes.
+//Lines starting with '$' or 'T' are time sync lines, not commands, and get no
+//reply (see sync_rx()).
+//e.g. "t 06:59:50;a 7:00;s" -> "t 06:59:50;a 07:00:00;s 06:59:50 07:00:00 1 0 0 2"
+//A whole unit in one line: "t 6:59:50;d 1;a0 7:00 -MTWTF-;a1 8:30 S-----S;
+//a2 0:00 -------;a3 12:15 ---W---!;b 3;c 50;z 60" (on one line, 93 characters).
+
+//USART0 at BAUD 8N1, receive interrupt on
+void console_init(void)
+{
+    UBRR0 = MYUBRR;
+    UCSR0C = (1<<UCSZ01)|(1<<UCSZ00);
+    UCSR0B = (1<<RXCIE0)|(1<<RXEN0)|(1<<TXEN0);
 }
 
+//Queue a byte, waits only while the TX ring is full (a byte time at most)
+void console_putc(char c)
+{
+    uint8_t head = tx_head;
+    uint8_t next = (head + 1) & (CONSOLE_TX_SIZE - 1);
+
+    while(next == tx_tail) hal_spin(); //USART_UDRE_vect makes room
 
-//Make noise for time_on in (ms)
-void siren(int duration)
+    tx_buf[head] = c;
+    tx_head = next;
+    UCSR0B |= (1<<UDRIE0); //USART_UDRE_vect turns it off when the ring is empty
+}
+
+void console_put_number(uint32_t n)
 {
+    char digits[10];
+    uint8_t i = 0;
 
-    for(int i = 0 ; i < duration ; i++)
+    do
     {
-        cbi(PORTB, BUZZ1);
-        sbi(PORTB, BUZZ2);
-        delay_us(300);
+        digits[i++] = '0' + n % 10;
+        n /= 10;
+    } while(n != 0);
 
-        sbi(PORTB, BUZZ1);
-        cbi(PORTB, BUZZ2);
-        delay_us(300);
-    }
+    while(i > 0) console_putc(digits[--i]);
+}
 
-    cbi(PORTB, BUZZ1);
-    cbi(PORTB, BUZZ2);
+//hh:mm:ss, 24-hour
+void console_put_tod(tod_t t)
+{
+    uint16_t m = (uint16_t)(t >> 2) / 15; //Minute of the day
+    uint8_t field[3];
 
-    delay_ms(50);
-    
-    for(int i = 0 ; i < duration ; i++)
+    field[0] = m / 60;
+    field[1] = m % 60;
+    field[2] = (uint8_t)t - (uint8_t)(m * 60);
+
+    for(uint8_t i = 0 ; i < 3 ; i++)
     {
-        cbi(PORTB, BUZZ1);
-        sbi(PORTB, BUZZ2);
-        delay_us(300);
+        if(i != 0) console_putc(':');
+        console_putc('0' + field[i] / 10);
+        console_putc('0' + field[i] % 10);
+    }
+}
+
+//Read hh:mm or hh:mm:ss (24-hour), TOD_NEVER if it isn't one
+tod_t console_get_tod(const char *s)
+{
+    uint8_t field[3] = {0, 0, 0};
+    uint8_t n = 0, digits = 0;
 
-        sbi(PORTB, BUZZ1);
-        cbi(PORTB, BUZZ2);
-        delay_us(300);
+    for( ; *s != 0 ; s++)
+    {
+        if(*s >= '0' && *s <= '9' && digits < 2)
+        {
+            field[n] = field[n] * 10 + (*s - '0');
+            digits++;
+        }
+        else if(*s == ':' && digits != 0 && n < 2)
+        {
+            n++;
+            digits = 0;
+        }
+        else
+            return(TOD_NEVER);
     }
 
-    cbi(PORTB, BUZZ1);
-    cbi(PORTB, BUZZ2);
+    if(n == 0 || digits == 0 || field[0] > 23 || field[1] > 59 || field[2] > 59) return(TOD_NEVER);
+
+    return((uint16_t)(field[0] * 60 + field[1]) * TOD_MINUTE + field[2]);
 }
 
-void ioinit(void)
+//Read a number -32767..32767, FALSE if it isn't one
+uint8_t console_get_int(const char *s, int16_t *v)
 {
-    //1 = output, 0 = input 
-    DDRB = 0b11111111 & ~((1<<BUT_UP)|(1<<BUT_DOWN)|(1<<BUT_ALARM)); //Up, Down, Alarm switch  
-    DDRC = 0b11111111;
-    DDRD = 0b11111111 & ~(1<<BUT_SNOOZE); //Snooze button
-    
+    uint8_t neg = (*s == '-');
+    uint8_t digits = 0;
+    uint32_t n = 0;
 
-    PORTB = (1<<BUT_UP)|(1<<BUT_DOWN)|(1<<BUT_ALARM); //Enable pull-ups on these pins
-    PORTD = 0b10100100; //Enable pull-up on snooze button
-    PORTC = 0b00111111;
+    if(*s == '-' || *s == '+') s++;
 
-    //Init Timer0 for delay_us
-    TCCR0B = (1<<CS01); //Set Prescaler to clk/8 : 1click = 0.5us(assume we are running at external 16MHz). CS01=1 
-    
-    //Init Timer1 for second counting <mds> CTC mode
-    TCCR1B = (1<<CS12)|(1<<CS10); //Set prescaler to clk/1024 :1click = 64us (assume we are running at 16MHz)
-    //<mds> set CTC mode
-    TCCR1B |= (1<<WGM12)|(1<<WGM13); // Mode 12 CTC mode
-    TIMSK1 = (1<<ICIE1); //Enable overflow interrupts
-    ICR1 = 15624; // SET TOP to 1s
-    //TCNT1 = 49911; //65536 - 15,625 = 49,911 - Preload timer 1 for 49,911 clicks. Should be 1s per ISR call
-    
-    //Init Timer2 for updating the display via interrupts
-    TCCR2B = (1<<CS22)|(1<<CS21)|(1<<CS20); //Set prescalar to clk/1024 : 1 click = 64us (assume 16MHz)
-    TIMSK2 = (1<<TOIE2);
-    //TCNT2 should overflow every 16.384 ms (256 * 64us)
-    
-    hours = 88;
-    minutes = 88;
-    seconds = 88;
+    for( ; *s != 0 ; s++)
+    {
+        if(*s < '0' || *s > '9' || ++digits > 5) return(FALSE);
+        n = n * 10 + (*s - '0');
+    }
 
-    alarm_going = FALSE;
-    
-    sei(); //Enable interrupts
+    if(digits == 0 || n > 32767) return(FALSE);
 
-    siren(20); //Make some noise at power up
-    
-    hours = 12;
-    minutes = 00;
-    seconds = 00;
-    ampm = AM;
-
-    hours_alarm = 11;
-    minutes_alarm = 55;
-    seconds_alarm = 00;
-    ampm_alarm = PM;
-
-    hours_alarm_snooze = 12;
-    minutes_alarm_snooze = 00;
-    seconds_alarm_snooze = 00;
-    ampm_alarm_snooze = AM;
-    
-    snooze = FALSE;
+    *v = neg ? -(int16_t)n : (int16_t)n;
+    return(TRUE);
+}
+
+//Read the days of an alarm, SMTWTFS with - for a day off and ! after it for a 
+//one-shot.  0xFF if it isn't that.
+uint8_t console_get_days(const char *s)
+{
+    uint8_t days = 0;
 
-    //Segment test
-    /*while(1)
+    for(uint8_t i = 0 ; i < WEEK_DAYS ; i++, s++)
     {
-        PORTD = 0;
-        PORTC = 0xFF;
-        delay_ms(1000);
+        if(*s == 0) return(0xFF);
+        if(*s != '-') days |= (1 << i);
+    }
+    if(*s == '!')
+    {
+        days |= ALARM_ONCE;
+        s++;
+    }
 
-        PORTD = 0xFF;
-        PORTC = 0xFF;
-        delay_ms(1000);
-    }*/ 
+    return(*s == 0 ? days : 0xFF);
 }
 
-//General short delays
-void delay_ms(uint16_t x)
+//Run one command and send its reply, without the line end
+void console_command(char *cmd)
 {
-    for (; x > 0 ; x--)
+    static const char day_letters[WEEK_DAYS] = "SMTWTFS";
+    char verb;
+    char *end, *arg;
+    uint16_t awake, phase, bad;
+    uint8_t which, days;
+    int16_t n;
+    uint32_t up;
+    tod_t t;
+
+    while(*cmd == ' ') cmd++;
+    end = cmd + strlen(cmd);
+    while(end > cmd && end[-1] == ' ') *--end = 0;
+    if(*cmd == 0) return; //Empty, empty reply
+
+    verb = *cmd++;
+    which = 0xFF;
+    if(verb == 'a' && *cmd >= '0' && *cmd <= '9') which = *cmd++ - '0'; //a<n>
+    while(*cmd == ' ') cmd++; //Argument, "" if none
+
+    switch(verb)
     {
-        delay_us(250);
-        delay_us(250);
-        delay_us(250);
-        delay_us(250);
+        case 't':
+            if(*cmd != 0)
+            {
+                if( (t = console_get_tod(cmd)) == TOD_NEVER ) break;
+                time_set(t);
+            }
+            console_putc('t');
+            console_putc(' ');
+            console_put_tod(time_get());
+            return;
+
+        case 'a':
+            if(which == 0xFF)
+            {
+                if(*cmd != 0)
+                {
+                    if( (t = console_get_tod(cmd)) == TOD_NEVER ) break;
+                    alarm_set(0, t, alarms[0].days);
+                }
+                console_putc('a');
+                console_putc(' ');
+                console_put_tod(alarms[0].time);
+                return;
+            }
+
+            if(which >= ALARMS) break;
+            if(*cmd != 0)
+            {
+                days = alarms[which].days;
+                if( (arg = strchr(cmd, ' ')) != NULL )
+                {
+                    *arg++ = 0;
+                    while(*arg == ' ') arg++;
+                    if( (days = console_get_days(arg)) == 0xFF ) break;
+                }
+                if( (t = console_get_tod(cmd)) == TOD_NEVER ) break;
+                alarm_set(which, t, days);
+                if(arg != NULL && (days & ALARM_DAYS) == 0) alarms[which].days = 0; //------- is off
+            }
+            console_putc('a');
+            console_putc('0' + which);
+            console_putc(' ');
+            console_put_tod(alarms[which].time);
+            console_putc(' ');
+            for(uint8_t i = 0 ; i < WEEK_DAYS ; i++)
+                console_putc( (alarms[which].days & (1 << i)) ? day_letters[i] : '-' );
+            if(alarms[which].days & ALARM_ONCE) console_putc('!');
+            return;
+
+        case 'd':
+            if(*cmd != 0)
+            {
+                if( !console_get_int(cmd, &n) || n < 0 || n >= WEEK_DAYS ) break;
+                time_set_wday(n);
+            }
+            console_putc('d');
+            console_putc(' ');
+            time_get_day(&days);
+            console_putc('0' + days);
+            return;
+
+        case 'n':
+            if(*cmd != 0) break;
+            if(alarm_resched)
+            {
+                t = time_get_tick(&days, &up);
+                alarm_schedule(t, days, up);
+            }
+            console_putc('n');
+            console_putc(' ');
+            if(alarm_due == TOD_NEVER)
+            {
+                console_putc('-');
+                return;
+            }
+            console_putc('0' + alarm_due_day);
+            console_putc(' ');
+            console_put_tod(alarm_due);
+            return;
+
+        case 'c':
+            if(*cmd != 0)
+            {
+                if( !console_get_int(cmd, &n) || n > TRIM_MAX || n < -TRIM_MAX ) break;
+                trim_set(n);
+            }
+            console_putc('c');
+            console_putc(' ');
+            if(clock_trim < 0) console_putc('-');
+            console_put_number(clock_trim < 0 ? -clock_trim : clock_trim);
+            return;
+
+        case 'b':
+            if(*cmd != 0)
+            {
+                if( !console_get_int(cmd, &n) || n < 0 || n >= DISPLAY_LEVELS ) break;
+                display_level_set(n);
+            }
+            console_putc('b');
+            console_putc(' ');
+            console_put_number(display_level);
+            return;
+
+        case 'l':
+            if(*cmd != 0) break;
+            console_putc('l');
+            console_putc(' ');
+            console_put_number(alarm_fired);
+            console_putc(' ');
+            console_put_number(alarm_late_ms);
+            console_putc(' ');
+            console_put_number(alarm_late_max);
+            return;
+
+        case 'y':
+            if(*cmd != 0) break;
+            console_putc('y');
+            console_putc(' ');
+            console_put_number(sync_count);
+            console_putc(' ');
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+            {
+                bad = sync_bad;
+            }
+            console_put_number(bad);
+            console_putc(' ');
+            if(sync_offset_ms < 0) console_putc('-');
+            console_put_number(sync_offset_ms < 0 ? -sync_offset_ms : sync_offset_ms);
+            return;
+
+        case 'z':
+            if(*cmd != 0)
+            {
+                if( !console_get_int(cmd, &n) || n > SYNC_ZONE_MAX || n < -SYNC_ZONE_MAX ) break;
+                sync_zone = n;
+            }
+            console_putc('z');
+            console_putc(' ');
+            if(sync_zone < 0) console_putc('-');
+            console_put_number(sync_zone < 0 ? -sync_zone : sync_zone);
+            return;
+
+#ifdef TRACE
+        case 'e':
+            if( *cmd != 0 && (!console_get_int(cmd, &n) || n < 0 || n > 0xFF) ) break;
+            console_putc('e');
+            console_putc(' ');
+            trace_dump(*cmd != 0 ? n : 0, *cmd == 0);
+            return;
+#endif
+
+        case 'u':
+            if(*cmd != 0) break;
+            console_putc('u');
+            console_putc(' ');
+            console_put_number(uptime_get(&phase));
+            console_putc(' ');
+            console_put_number(phase);
+            return;
+
+        case 's':
+            if(*cmd != 0) break;
+            console_putc('s');
+            console_putc(' ');
+            console_put_tod(time_get());
+            console_putc(' ');
+            if(alarm_resched)
+            {
+                t = time_get_tick(&days, &up);
+                alarm_schedule(t, days, up);
+            }
+            if(alarm_due == TOD_NEVER)
+                console_putc('-');
+            else
+                console_put_tod(alarm_due);
+            console_putc(' ');
+            console_putc( (input_state & (1<<BUT_ALARM)) ? '1' : '0' );
+            console_putc(' ');
+            console_putc( alarm_going ? '1' : '0' );
+            console_putc(' ');
+            console_putc( snooze ? '1' : '0' );
+            console_putc(' ');
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+            {
+                awake = cpu_awake_slots;
+            }
+            console_put_number(awake * 100UL / SLOTS_PER_SECOND);
+            return;
     }
+
+    console_putc('?'); //Unknown, or a bad argument
 }
 
-//General short delays
-void delay_us(uint16_t x)
+//Arm the time sync line sync_rx() handed over, and count the ones applied
+//The line's time T was at its first byte, the byte time and the hundredths
+//before sync_line_sec/phase.  The next second to start is T plus the seconds
+//since, or if T fell into a second, the one before that with TCNT1 at the
+//rest of it, and TIMER1_CAPT_vect starts it so.  NMEA times are UTC, sync_zone
+//makes them local.  The day of the week is worked out from the date, a line
+//without one leaves it.
+void check_sync(void)
 {
-    x *= 2; //Correction for 16MHz
-    
-    while(x > 256)
+    static const uint8_t month_key[12] = { 0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4 }; //Sakamoto's
+    const uint8_t *d = sync_d;
+    uint8_t h, m, s, day, month, wday;
+    uint16_t year;
+    int32_t p, off;
+    uint32_t sec, k;
+    tod_t t;
+
+    if(sync_applied)
     {
-        TIFR0 = (1<<TOV0); //Clear any interrupt flags on Timer2
-        TCNT0 = 0; //256 - 125 = 131 : Preload timer 2 for x clicks. Should be 1us per click
-        while( (TIFR0 & (1<<TOV0)) == 0);
-        
-        x -= 256;
+        sync_applied = FALSE;
+        off = tod_until(sync_was, sync_next);
+        if(off > TOD_DAY / 2) off -= TOD_DAY;
+        sync_offset_ms = off * 1000 + sync_phase * 64L / 1000;
+        sync_count++;
+        time_unsure = FALSE;
+        persist_time_moved = TRUE;
+        alarm_resched = TRUE;
+    }
+
+    if(!sync_ready) return;
+
+    h = d[SYNC_D_TIME] * 10 + d[SYNC_D_TIME + 1];
+    m = d[SYNC_D_TIME + 2] * 10 + d[SYNC_D_TIME + 3];
+    s = d[SYNC_D_TIME + 4] * 10 + d[SYNC_D_TIME + 5];
+    if(h > 23 || m > 59 || s > 59)
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            sync_bad++;
+        }
+        sync_ready = FALSE;
+        return;
+    }
+    t = (uint16_t)(h * 60 + m) * TOD_MINUTE + s;
+
+    wday = 0xFF;
+    if(sync_kind != SYNC_T)
+    {
+        day = d[SYNC_D_DATE] * 10 + d[SYNC_D_DATE + 1];
+        month = d[SYNC_D_DATE + 2] * 10 + d[SYNC_D_DATE + 3];
+        year = 2000 + d[SYNC_D_DATE + 4] * 10 + d[SYNC_D_DATE + 5];
+        if( (sync_got & SYNC_GOT_DATE) && day >= 1 && day <= 31 && month >= 1 && month <= 12 )
+        {
+            if(month < 3) year--;
+            wday = (year + year / 4 - year / 100 + year / 400 + month_key[month - 1] + day) % WEEK_DAYS;
+        }
+
+        off = (int32_t)t + sync_zone * TOD_MINUTE;
+        if(off < 0)
+        {
+            off += TOD_DAY;
+            if(wday < WEEK_DAYS) wday = wday ? wday - 1 : WEEK_DAYS - 1;
+        }
+        else if(off >= TOD_DAY)
+        {
+            off -= TOD_DAY;
+            if(wday < WEEK_DAYS && ++wday == WEEK_DAYS) wday = 0;
+        }
+        t = off;
+    }
+
+    //Where T was: second sec, phase p
+    sec = sync_line_sec;
+    p = (int32_t)sync_line_phase - SYNC_CHAR_COUNTS - (d[SYNC_D_CS] * 10 + d[SYNC_D_CS + 1]) * (TIMER1_TOP + 1L) / 100;
+    if(p > TIMER1_TOP)
+    {
+        p -= TIMER1_TOP + 1;
+        sec++;
+    }
+    while(p < 0)
+    {
+        p += TIMER1_TOP + 1;
+        sec--;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        k = uptime_sec + 1 - sec; //Seconds from T's to the next one to start
+        if(k <= SYNC_STALE)
+        {
+            if(p != 0) k--;
+            p = (p != 0) ? TIMER1_TOP + 1 - p : 0;
+            if(p > TIMER1_TOP - 3) p = TIMER1_TOP - 3; //Below the shortest trimmed ICR1
+            t += k;
+            if(t >= TOD_DAY)
+            {
+                t -= TOD_DAY;
+                if(wday < WEEK_DAYS && ++wday == WEEK_DAYS) wday = 0;
+            }
+            sync_next = t;
+            sync_next_wday = wday;
+            sync_phase = p;
+            sync_armed = TRUE;
+        }
     }
+    sync_ready = FALSE;
+}
+
+//Run the command lines that came in
+void check_console(void)
+{
+    static char line[CONSOLE_LINE + 1];
+    static uint8_t len;
+    uint8_t tail = rx_tail;
+    char c, *cmd, *end;
+
+    check_sync();
+
+    while(tail != rx_head)
+    {
+        c = rx_buf[tail];
+        tail = (tail + 1) & (CONSOLE_RX_SIZE - 1);
+        rx_tail = tail; //Room for USART_RX_vect
+
+        if(c != '\r' && c != '\n')
+        {
+            if(len < CONSOLE_LINE)
+                line[len++] = c;
+            else
+                rx_overrun = TRUE; //Too long
+            continue;
+        }
+
+        if(rx_overrun)
+        {
+            rx_overrun = FALSE;
+            len = 0;
+            console_putc('?');
+        }
+        else if(len == 0)
+            continue; //Blank line, or the \n of \r\n
+        else
+        {
+            line[len] = 0;
+            len = 0;
+
+            for(cmd = line ; ; cmd = end + 1)
+            {
+                end = strchr(cmd, ';');
+                if(end != NULL) *end = 0;
+                console_command(cmd);
+                if(end == NULL) break;
+                console_putc(';');
+            }
+        }
 
-    TIFR0 = (1<<TOV0); //Clear any interrupt flags on Timer2
-    TCNT0 = 256 - x; //256 - 125 = 131 : Preload timer 2 for x clicks. Should be 1us per click
-    while( (TIFR0 & (1<<TOV0)) == 0);
+        console_putc('\r');
+        console_putc('\n');
+    }
 }
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#endif
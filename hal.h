@@ -0,0 +1,25 @@
+/*
+ Clockit hardware abstraction <hal.h>
+
+ The firmware talks to the ATmega328P through the avr-libc register names
+ (PORTB, TCCR1B, ...).  The host build (make host) compiles the same 
+ clockit-v12.c against host/include instead, where those names are the 
+ registers of a simulated chip run by host/sim.c.  Only what cannot be a
+ plain register access is here.
+*/
+#ifndef HAL_H
+#define HAL_H
+
+#ifdef HOST
+void host_spin(void);
+void host_frames(uint16_t ms);
+#define hal_spin()      host_spin()     //Body of a busy-wait loop: let simulated time pass
+#define hal_frames(ms)  host_frames(ms) //Main counts on the multiplex interrupt for ms: keep it running
+#define HAL_NOINIT                      //Kept through a reset: the simulator never resets
+#else
+#define hal_spin()              //Body of a busy-wait loop: nothing to do on the chip
+#define hal_frames(ms)          //The multiplex interrupt always runs on the chip
+#define HAL_NOINIT  __attribute__((section(".noinit"))) //Kept through a reset, not cleared at start-up
+#endif
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ Clockit board wiring <host/board.h>
+
+ The Clockit pins as seen from outside the chip, for the host simulator
+ (host/sim.c).  Built from the board header the firmware is compiled for
+ (BOARD_HEADER, boards/v12.h by default), with the port of each line as the
+ firmware lays them out (see boards/v12.h), so a board is described once.
+*/
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <stdint.h>
+#include <avr/io.h> //PORTxn bit names for the board header
+
+#ifndef BOARD_HEADER
+#define BOARD_HEADER "boards/v12.h"
+#endif
+#include BOARD_HEADER
+
+#define BOARD_F_CPU     ((uint64_t)F_CPU) //Crystal
+
+#define BOARD_PORT_B    0
+#define BOARD_PORT_C    1
+#define BOARD_PORT_D    2
+
+typedef struct { uint8_t port, mask; } board_pin_t;
+
+//A segment is on PORTC or PORTD, its mask on the other port is 0
+#define BOARD_SEG(s)    { (SEG_##s##_C) ? BOARD_PORT_C : BOARD_PORT_D, (SEG_##s##_C) | (SEG_##s##_D) }
+
+//Commons, lit at BOARD_COMMON_ANODE: DIG1-4, COL, AMPM
+static const board_pin_t board_common[6] = { {BOARD_PORT_D, 1<<DIG_1}, {BOARD_PORT_D, 1<<DIG_2}, {BOARD_PORT_D, 1<<DIG_3}, {BOARD_PORT_D, 1<<DIG_4}, {BOARD_PORT_D, 1<<COL}, {BOARD_PORT_B, 1<<AMPM} };
+#define BOARD_COMMON_COL    4
+#define BOARD_COMMON_AMPM   5
+
+//Segments, lit at the other level: A-G, DP.  The colon and AM/PM dots on theirs.
+static const board_pin_t board_segment[8] = { BOARD_SEG(A), BOARD_SEG(B), BOARD_SEG(C), BOARD_SEG(D), BOARD_SEG(E), BOARD_SEG(F), BOARD_SEG(G), BOARD_SEG(DP) };
+static const board_pin_t board_seg_col = BOARD_SEG(COL), board_seg_ampm = BOARD_SEG(AMPM);
+
+//Buttons short to ground, the alarm switch pulls high when on and to ground when off
+#define BOARD_BUTTON_UP     0
+#define BOARD_BUTTON_DOWN   1
+#define BOARD_BUTTON_SNOOZE 2
+static const board_pin_t board_button[3] = { {BOARD_PORT_B, 1<<BUT_UP}, {BOARD_PORT_B, 1<<BUT_DOWN}, {BOARD_PORT_D, 1<<BUT_SNOOZE} };
+static const char * const board_button_name[3] = { "up", "down", "snooze" };
+static const board_pin_t board_alarm = { BOARD_PORT_B, 1<<BUT_ALARM };
+
+//Piezo between BUZZ1 and BUZZ2
+#define BOARD_BUZZ_PORT     BOARD_PORT_B
+#define BOARD_BUZZ_MASK     ((1<<BUZZ1)|(1<<BUZZ2))
+
+#endif
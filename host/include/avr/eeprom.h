@@ -0,0 +1,84 @@
+/*
+ Host build <avr/eeprom.h>
+
+ The avr-libc EEPROM calls, done the way the chip wants it through EEAR, EEDR
+ and EECR, so host/sim.c sees the reads and the timed writes.  An EEPROM
+ address is passed as a pointer, as with avr-libc.  EEMEM is not supported,
+ there is no .eeprom section on the host.
+*/
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <avr/io.h>
+
+void host_spin(void);
+
+#define eeprom_is_ready()   ((EECR & (1<<EEPE)) == 0)
+#define eeprom_busy_wait()  do { while(!eeprom_is_ready()) host_spin(); } while(0)
+
+static inline uint8_t eeprom_read_byte(const uint8_t *p)
+{
+    eeprom_busy_wait();
+    EEAR = (uint16_t)(uintptr_t)p;
+    EECR |= (1<<EERE);
+    return(EEDR);
+}
+
+static inline void eeprom_write_byte(uint8_t *p, uint8_t v)
+{
+    uint8_t sreg;
+
+    eeprom_busy_wait();
+    EEAR = (uint16_t)(uintptr_t)p;
+    EEDR = v;
+    sreg = SREG;
+    SREG = sreg & (uint8_t)~(1<<SREG_I);
+    EECR = (EECR & (1<<EERIE)) | (1<<EEMPE); //Erase and write
+    EECR |= (1<<EEPE);
+    SREG = sreg;
+}
+
+static inline void eeprom_update_byte(uint8_t *p, uint8_t v)
+{
+    if(eeprom_read_byte(p) != v) eeprom_write_byte(p, v);
+}
+
+static inline void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    for(size_t i = 0 ; i < n ; i++)
+        ((uint8_t *)dst)[i] = eeprom_read_byte((const uint8_t *)src + i);
+}
+
+static inline void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+    for(size_t i = 0 ; i < n ; i++)
+        eeprom_update_byte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+}
+
+static inline void eeprom_write_block(const void *src, void *dst, size_t n)
+{
+    for(size_t i = 0 ; i < n ; i++)
+        eeprom_write_byte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+}
+
+static inline uint16_t eeprom_read_word(const uint16_t *p)
+{
+    uint16_t v;
+
+    eeprom_read_block(&v, p, 2); //Little endian, like the AVR
+    return(v);
+}
+
+static inline void eeprom_update_word(uint16_t *p, uint16_t v)
+{
+    eeprom_update_block(&v, p, 2);
+}
+
+static inline void eeprom_write_word(uint16_t *p, uint16_t v)
+{
+    eeprom_write_block(&v, p, 2);
+}
+
+#endif
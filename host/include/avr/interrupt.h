@@ -0,0 +1,41 @@
+/*
+ Host build <avr/interrupt.h>
+
+ ISR(vector) defines a plain function that host/sim.c calls when the 
+ interrupt is taken.  The vector names map to the host_vect_* functions 
+ host/sim.c knows about.
+*/
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define sei()   (SREG |= (1 << SREG_I))
+#define cli()   (SREG &= (uint8_t)~(1 << SREG_I))
+
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR_NAKED
+#define ISR(vector, ...)    void vector(void); void vector(void)
+#define reti()  return
+
+#define PCINT0_vect         host_vect_pcint0
+#define PCINT1_vect         host_vect_pcint1
+#define PCINT2_vect         host_vect_pcint2
+#define WDT_vect            host_vect_wdt
+#define TIMER2_COMPA_vect   host_vect_timer2_compa
+#define TIMER2_COMPB_vect   host_vect_timer2_compb
+#define TIMER2_OVF_vect     host_vect_timer2_ovf
+#define TIMER1_CAPT_vect    host_vect_timer1_capt
+#define TIMER1_COMPA_vect   host_vect_timer1_compa
+#define TIMER1_COMPB_vect   host_vect_timer1_compb
+#define TIMER1_OVF_vect     host_vect_timer1_ovf
+#define TIMER0_COMPA_vect   host_vect_timer0_compa
+#define TIMER0_COMPB_vect   host_vect_timer0_compb
+#define TIMER0_OVF_vect     host_vect_timer0_ovf
+#define USART_RX_vect       host_vect_usart_rx
+#define USART_UDRE_vect     host_vect_usart_udre
+#define USART_TX_vect       host_vect_usart_tx
+#define EE_READY_vect       host_vect_ee_ready
+
+#endif
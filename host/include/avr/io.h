@@ -0,0 +1,237 @@
+/*
+ Host build <avr/io.h>
+
+ The ATmega328P I/O registers for the host build (make host).  Every register
+ access goes through host_reg8()/host_reg16() in host/sim.c, which lets the
+ simulated clock catch up, takes pending interrupts and sees what the firmware
+ wrote, then hands back the register's place in host_io[] (its data space 
+ address, as on the chip).  host/sim.c itself defines HOST_SIM and gets the 
+ plain addresses instead.
+*/
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+#ifdef HOST_SIM
+#define _SFR_MEM8(a)    (a)
+#define _SFR_MEM16(a)   (a)
+#else
+volatile uint8_t *host_reg8(uint8_t addr);
+volatile uint16_t *host_reg16(uint8_t addr);
+#define _SFR_MEM8(a)    (*host_reg8(a))
+#define _SFR_MEM16(a)   (*host_reg16(a))
+#endif
+
+#define _BV(b) (1 << (b))
+
+#define PINB _SFR_MEM8(0x23)
+#define DDRB _SFR_MEM8(0x24)
+#define PORTB _SFR_MEM8(0x25)
+#define PINC _SFR_MEM8(0x26)
+#define DDRC _SFR_MEM8(0x27)
+#define PORTC _SFR_MEM8(0x28)
+#define PIND _SFR_MEM8(0x29)
+#define DDRD _SFR_MEM8(0x2A)
+#define PORTD _SFR_MEM8(0x2B)
+#define TIFR0 _SFR_MEM8(0x35)
+#define TIFR1 _SFR_MEM8(0x36)
+#define TIFR2 _SFR_MEM8(0x37)
+#define PCIFR _SFR_MEM8(0x3B)
+#define EIFR _SFR_MEM8(0x3C)
+#define EIMSK _SFR_MEM8(0x3D)
+#define GPIOR0 _SFR_MEM8(0x3E)
+#define EECR _SFR_MEM8(0x3F)
+#define EEDR _SFR_MEM8(0x40)
+#define EEAR _SFR_MEM16(0x41)
+#define GTCCR _SFR_MEM8(0x43)
+#define TCCR0A _SFR_MEM8(0x44)
+#define TCCR0B _SFR_MEM8(0x45)
+#define TCNT0 _SFR_MEM8(0x46)
+#define OCR0A _SFR_MEM8(0x47)
+#define OCR0B _SFR_MEM8(0x48)
+#define GPIOR1 _SFR_MEM8(0x4A)
+#define GPIOR2 _SFR_MEM8(0x4B)
+#define ACSR _SFR_MEM8(0x50)
+#define SMCR _SFR_MEM8(0x53)
+#define MCUSR _SFR_MEM8(0x54)
+#define MCUCR _SFR_MEM8(0x55)
+#define SREG _SFR_MEM8(0x5F)
+#define WDTCSR _SFR_MEM8(0x60)
+#define PRR _SFR_MEM8(0x64)
+#define PCICR _SFR_MEM8(0x68)
+#define PCMSK0 _SFR_MEM8(0x6B)
+#define PCMSK1 _SFR_MEM8(0x6C)
+#define PCMSK2 _SFR_MEM8(0x6D)
+#define TIMSK0 _SFR_MEM8(0x6E)
+#define TIMSK1 _SFR_MEM8(0x6F)
+#define TIMSK2 _SFR_MEM8(0x70)
+#define ADCSRA _SFR_MEM8(0x7A)
+#define TCCR1A _SFR_MEM8(0x80)
+#define TCCR1B _SFR_MEM8(0x81)
+#define TCCR1C _SFR_MEM8(0x82)
+#define TCNT1 _SFR_MEM16(0x84)
+#define ICR1 _SFR_MEM16(0x86)
+#define OCR1A _SFR_MEM16(0x88)
+#define OCR1B _SFR_MEM16(0x8A)
+#define TCCR2A _SFR_MEM8(0xB0)
+#define TCCR2B _SFR_MEM8(0xB1)
+#define TCNT2 _SFR_MEM8(0xB2)
+#define OCR2A _SFR_MEM8(0xB3)
+#define OCR2B _SFR_MEM8(0xB4)
+#define ASSR _SFR_MEM8(0xB6)
+#define UCSR0A _SFR_MEM8(0xC0)
+#define UCSR0B _SFR_MEM8(0xC1)
+#define UCSR0C _SFR_MEM8(0xC2)
+#define UBRR0 _SFR_MEM16(0xC4)
+#define UDR0 _SFR_MEM8(0xC6)
+
+//Bits
+#define PORTB0 0
+#define PORTB1 1
+#define PORTB2 2
+#define PORTB3 3
+#define PORTB4 4
+#define PORTB5 5
+#define PORTB6 6
+#define PORTB7 7
+#define PORTC0 0
+#define PORTC1 1
+#define PORTC2 2
+#define PORTC3 3
+#define PORTC4 4
+#define PORTC5 5
+#define PORTC6 6
+#define PORTD0 0
+#define PORTD1 1
+#define PORTD2 2
+#define PORTD3 3
+#define PORTD4 4
+#define PORTD5 5
+#define PORTD6 6
+#define PORTD7 7
+#define TOV0 0
+#define OCF0A 1
+#define OCF0B 2
+#define TOV1 0
+#define OCF1A 1
+#define OCF1B 2
+#define ICF1 5
+#define TOV2 0
+#define OCF2A 1
+#define OCF2B 2
+#define PCIF0 0
+#define PCIF1 1
+#define PCIF2 2
+#define EERE 0
+#define EEPE 1
+#define EEMPE 2
+#define EERIE 3
+#define EEPM0 4
+#define EEPM1 5
+#define PSRSYNC 0
+#define PSRASY 1
+#define TSM 7
+#define WGM00 0
+#define WGM01 1
+#define COM0B0 4
+#define COM0B1 5
+#define COM0A0 6
+#define COM0A1 7
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM02 3
+#define ACD 7
+#define SE 0
+#define SM0 1
+#define SM1 2
+#define SM2 3
+#define PORF 0
+#define EXTRF 1
+#define BORF 2
+#define WDRF 3
+#define PUD 4
+#define WDP0 0
+#define WDP1 1
+#define WDP2 2
+#define WDE 3
+#define WDCE 4
+#define WDP3 5
+#define WDIE 6
+#define WDIF 7
+#define PRADC 0
+#define PRUSART0 1
+#define PRSPI 2
+#define PRTIM1 3
+#define PRTIM0 5
+#define PRTIM2 6
+#define PRTWI 7
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define PCINT0 0
+#define PCINT4 4
+#define PCINT5 5
+#define PCINT23 7
+#define TOIE0 0
+#define OCIE0A 1
+#define OCIE0B 2
+#define TOIE1 0
+#define OCIE1A 1
+#define OCIE1B 2
+#define ICIE1 5
+#define TOIE2 0
+#define OCIE2A 1
+#define OCIE2B 2
+#define ADEN 7
+#define WGM10 0
+#define WGM11 1
+#define COM1B0 4
+#define COM1B1 5
+#define COM1A0 6
+#define COM1A1 7
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define WGM13 4
+#define ICES1 6
+#define ICNC1 7
+#define WGM20 0
+#define WGM21 1
+#define COM2B0 4
+#define COM2B1 5
+#define COM2A0 6
+#define COM2A1 7
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM22 3
+#define MPCM0 0
+#define U2X0 1
+#define UPE0 2
+#define DOR0 3
+#define FE0 4
+#define UDRE0 5
+#define TXC0 6
+#define RXC0 7
+#define TXB80 0
+#define RXB80 1
+#define UCSZ02 2
+#define TXEN0 3
+#define RXEN0 4
+#define UDRIE0 5
+#define TXCIE0 6
+#define RXCIE0 7
+#define UCPOL0 0
+#define UCSZ00 1
+#define UCSZ01 2
+#define USBS0 3
+#define UPM00 4
+#define UPM01 5
+#define SREG_I 7
+#define E2END 0x3FF
+#define RAMEND 0x8FF
+
+#endif
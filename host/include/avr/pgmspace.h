@@ -0,0 +1,18 @@
+/*
+ Host build <avr/pgmspace.h>
+
+ There is only one address space on the host, flash reads are plain reads.
+*/
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s)             (s)
+#define pgm_read_byte(p)    (*(const uint8_t *)(p))
+#define pgm_read_word(p)    (*(const uint16_t *)(p))
+#define pgm_read_dword(p)   (*(const uint32_t *)(p))
+#define pgm_read_ptr(p)     (*(void * const *)(p))
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ Host build <avr/sleep.h>
+
+ sleep_cpu() lets the simulated clock run to the next interrupt.
+*/
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE         0
+#define SLEEP_MODE_ADC          (1<<SM0)
+#define SLEEP_MODE_PWR_DOWN     (1<<SM1)
+#define SLEEP_MODE_PWR_SAVE     ((1<<SM0)|(1<<SM1))
+
+#define set_sleep_mode(mode)    (SMCR = (SMCR & (uint8_t)~((1<<SM0)|(1<<SM1)|(1<<SM2))) | (mode))
+#define sleep_enable()          (SMCR |= (1<<SE))
+#define sleep_disable()         (SMCR &= (uint8_t)~(1<<SE))
+
+void host_sleep_cpu(void);
+#define sleep_cpu()             host_sleep_cpu()
+
+#endif
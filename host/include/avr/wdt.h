@@ -0,0 +1,39 @@
+/*
+ Host build <avr/wdt.h>
+
+ The avr-libc watchdog calls, done through WDTCSR with the timed WDCE sequence
+ like the chip wants it.  The simulator has no watchdog, so it never bites, and
+ wdt_reset() (WDR) does nothing.
+*/
+#ifndef HOST_AVR_WDT_H
+#define HOST_AVR_WDT_H
+
+#include <stdint.h>
+#include <avr/io.h>
+
+#define WDTO_15MS   0
+#define WDTO_30MS   1
+#define WDTO_60MS   2
+#define WDTO_120MS  3
+#define WDTO_250MS  4
+#define WDTO_500MS  5
+#define WDTO_1S     6
+#define WDTO_2S     7
+#define WDTO_4S     8
+#define WDTO_8S     9
+
+#define wdt_reset()
+
+static inline void wdt_enable(uint8_t timeout)
+{
+    WDTCSR = (1<<WDCE)|(1<<WDE);
+    WDTCSR = (1<<WDE) | (timeout & 7) | ((timeout & 8) ? (1<<WDP3) : 0);
+}
+
+static inline void wdt_disable(void)
+{
+    WDTCSR = (1<<WDCE)|(1<<WDE);
+    WDTCSR = 0;
+}
+
+#endif
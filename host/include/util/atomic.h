@@ -0,0 +1,20 @@
+/*
+ Host build <util/atomic.h>
+
+ Same shape as the avr-libc ATOMIC_BLOCK(): interrupts off for the block, 
+ SREG put back by a cleanup handler on the way out.
+*/
+#ifndef HOST_UTIL_ATOMIC_H
+#define HOST_UTIL_ATOMIC_H
+
+#include <avr/interrupt.h>
+
+static inline uint8_t host_atomic_cli(void) { cli(); return(1); }
+static inline void host_atomic_restore(const uint8_t *sreg_save) { SREG = *sreg_save; }
+static inline void host_atomic_sei(const uint8_t *dummy) { (void)dummy; sei(); }
+
+#define ATOMIC_BLOCK(type)      for(type, host_atomic_todo = host_atomic_cli(); host_atomic_todo; host_atomic_todo = 0)
+#define ATOMIC_RESTORESTATE     uint8_t sreg_save __attribute__((__cleanup__(host_atomic_restore))) = SREG
+#define ATOMIC_FORCEON          uint8_t sreg_save __attribute__((__cleanup__(host_atomic_sei))) = 0
+
+#endif
@@ -0,0 +1,22 @@
+/*
+ Host build <util/crc16.h>
+
+ The avr-libc CRC updates the firmware uses, the same as the C equivalents
+ in the avr-libc manual.
+*/
+#ifndef HOST_UTIL_CRC16_H
+#define HOST_UTIL_CRC16_H
+
+#include <stdint.h>
+
+//CRC-8-CCITT, polynomial x^8 + x^2 + x + 1 (0x07)
+static inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data)
+{
+    crc ^= data;
+    for(uint8_t i = 0 ; i < 8 ; i++)
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+
+    return(crc);
+}
+
+#endif
@@ -0,0 +1,188 @@
+/*
+ Clockit scenario scripts <host/script.c>
+
+ Reads a script (format in script.h) into script[], sorted by time.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "script.h"
+
+script_event_t *script;
+unsigned script_len;
+
+//Time in cycles from 90, 1.5, 250ms, 2h30m, 1d, 12:00:05 or 7d12:00:00, SCRIPT_NEVER if bad
+uint64_t script_time(const char *s)
+{
+    uint64_t total = 0;
+    char *end;
+
+    if(*s == 0) return(SCRIPT_NEVER);
+
+    while(*s)
+    {
+        double v = strtod(s, &end);
+
+        if(end == s) return(SCRIPT_NEVER);
+        s = end;
+
+        if(*s == ':') //hh:mm[:ss]
+        {
+            double m, sec = 0;
+
+            m = strtod(s + 1, &end);
+            if(end == s + 1) return(SCRIPT_NEVER);
+            s = end;
+            if(*s == ':')
+            {
+                sec = strtod(s + 1, &end);
+                if(end == s + 1) return(SCRIPT_NEVER);
+                s = end;
+            }
+            total += (uint64_t)((v * 3600 + m * 60 + sec) * BOARD_F_CPU + 0.5);
+            continue;
+        }
+
+        if(strncmp(s, "ms", 2) == 0) v /= 1000, s += 2;
+        else if(*s == 'd') v *= 86400, s++;
+        else if(*s == 'h') v *= 3600, s++;
+        else if(*s == 'm') v *= 60, s++;
+        else if(*s == 's') s++;
+        else if(*s != 0) return(SCRIPT_NEVER);
+
+        total += (uint64_t)(v * BOARD_F_CPU + 0.5);
+    }
+
+    return(total);
+}
+
+//Insert an event after the ones at the same time or before, so the file order is kept
+static void script_add(uint64_t at, uint8_t what, uint8_t arg, const char *text)
+{
+    unsigned i;
+
+    script = realloc(script, (script_len + 1) * sizeof(*script));
+    if(script == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(2);
+    }
+
+    for(i = script_len ; i > 0 && script[i - 1].at > at ; i--)
+        script[i] = script[i - 1];
+
+    script[i].at = at;
+    script[i].what = what;
+    script[i].arg = arg;
+    script[i].text = text ? strdup(text) : NULL;
+    script_len++;
+}
+
+void script_load(const char *file)
+{
+    FILE *f = fopen(file, "r");
+    char line[256];
+    unsigned n = 0;
+    uint64_t prev = 0;
+
+    if(f == NULL)
+    {
+        perror(file);
+        exit(2);
+    }
+
+    while(fgets(line, sizeof(line), f))
+    {
+        char *p, *when, *verb, *arg, *rest;
+        uint64_t at;
+        int b = -1;
+
+        n++;
+        if( (p = strchr(line, '#')) != NULL ) *p = 0;
+        line[strcspn(line, "\r\n")] = 0;
+
+        when = strtok(line, " \t");
+        if(when == NULL) continue;
+        verb = strtok(NULL, " \t");
+        rest = strtok(NULL, "");
+        while(rest && isspace((unsigned char)*rest)) rest++;
+        arg = rest;
+
+        at = script_time(when[0] == '+' ? when + 1 : when);
+        if(at == SCRIPT_NEVER || verb == NULL) goto bad;
+        if(when[0] == '+') at += prev;
+        prev = at;
+
+        if(strcmp(verb, "echo") == 0)
+        {
+            script_add(at, SCRIPT_ECHO, 0, arg ? arg : "");
+            continue;
+        }
+        if(strcmp(verb, "send") == 0)
+        {
+            script_add(at, SCRIPT_SEND, 0, arg ? arg : "");
+            continue;
+        }
+        if(strcmp(verb, "end") == 0)
+        {
+            script_add(at, SCRIPT_END, 0, NULL);
+            continue;
+        }
+
+        if(arg) arg = strtok(arg, " \t");
+        if(arg == NULL) goto bad;
+
+        if(strcmp(verb, "alarm") == 0)
+        {
+            if(strcmp(arg, "on") == 0) script_add(at, SCRIPT_ALARM, 1, NULL);
+            else if(strcmp(arg, "off") == 0) script_add(at, SCRIPT_ALARM, 0, NULL);
+            else goto bad;
+            continue;
+        }
+
+        for(int i = 0 ; i < 3 ; i++)
+            if(strcmp(arg, board_button_name[i]) == 0) b = i;
+        if(b < 0) goto bad;
+
+        if(strcmp(verb, "press") == 0)
+            script_add(at, SCRIPT_PRESS, b, NULL);
+        else if(strcmp(verb, "release") == 0)
+            script_add(at, SCRIPT_RELEASE, b, NULL);
+        else if(strcmp(verb, "tap") == 0)
+        {
+            script_add(at, SCRIPT_PRESS, b, NULL);
+            script_add(at + SCRIPT_TAP, SCRIPT_RELEASE, b, NULL);
+        }
+        else if(strcmp(verb, "hold") == 0)
+        {
+            uint64_t len = SCRIPT_NEVER;
+
+            if( (arg = strtok(NULL, " \t")) != NULL ) len = script_time(arg);
+            if(len == SCRIPT_NEVER) goto bad;
+            script_add(at, SCRIPT_PRESS, b, NULL);
+            script_add(at + len, SCRIPT_RELEASE, b, NULL);
+        }
+        else
+            goto bad;
+
+        continue;
+
+    bad:
+        fprintf(stderr, "%s:%u: can't read this line\n", file, n);
+        exit(2);
+    }
+
+    fclose(f);
+}
+
+//Time of the first end line, SCRIPT_NEVER if none
+uint64_t script_end(void)
+{
+    uint64_t end = SCRIPT_NEVER;
+
+    for(unsigned i = 0 ; i < script_len ; i++)
+        if(script[i].what == SCRIPT_END && script[i].at < end) end = script[i].at;
+
+    return(end);
+}
@@ -0,0 +1,48 @@
+/*
+ Clockit scenario scripts <host/script.h>
+
+ Button and alarm switch events for the host simulator (host/sim.c).  One event
+ per line, # starts a comment:
+    <time> press|release|tap up|down|snooze
+    <time> hold up|down|snooze <duration>
+    <time> alarm on|off
+    <time> send <text>
+    <time> echo <text>
+    <time> end
+ A time is clock time since power up: 90, 1.5, 250ms, 2h30m, 1d, 12:00:05, 
+ 7d12:00:00.  With a leading + it is counted from the line before.  A tap holds
+ the button down for SCRIPT_TAP.  The alarm switch is off until the script 
+ turns it on.  send types a line into the serial port, a newline is added.
+*/
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdint.h>
+#include "board.h"
+
+#define SCRIPT_NEVER    UINT64_MAX
+#define SCRIPT_MS(x)    ((uint64_t)(x) * (BOARD_F_CPU / 1000)) //Times are in CPU clocks
+#define SCRIPT_TAP      SCRIPT_MS(150)
+
+#define SCRIPT_PRESS    0 //arg = BOARD_BUTTON_*
+#define SCRIPT_RELEASE  1
+#define SCRIPT_ALARM    2 //arg = on
+#define SCRIPT_ECHO     3 //text
+#define SCRIPT_END      4
+#define SCRIPT_SEND     5 //text
+
+typedef struct
+{
+    uint64_t at; //CPU clocks since power up
+    uint8_t what, arg;
+    char *text;
+} script_event_t;
+
+extern script_event_t *script; //Sorted by time
+extern unsigned script_len;
+
+uint64_t script_time(const char *s);
+void script_load(const char *file);
+uint64_t script_end(void);
+
+#endif
@@ -0,0 +1,1237 @@
+/*
+ Clockit host simulator <host/sim.c>
+
+ Runs clockit-v12.c on the build machine (make host) against a simulated
+ ATmega328P on the Clockit board, in virtual time.
+
+ The firmware is compiled unchanged with host/include in front of the avr-libc
+ headers, so every register access calls host_reg8()/host_reg16() here.  Those
+ are the only places the firmware and the simulator meet:
+ -Each access costs SIM_ACCESS_CYCLES of virtual time.  The C in between is free.
+ -The simulator looks at the register accessed just before, so it sees what was
+  written: TCNTn loads, PINx toggles, flag clears, new timer or pin settings.
+ -Timers are not stepped, they are worked out from the cycle count when something
+  looks at them or when their next enabled interrupt is due.
+ -With the I bit set, pending interrupts are taken before the access, highest
+  priority (lowest vector number) first.
+ sleep_cpu() jumps the virtual clock to the next interrupt, and hal_spin() in
+ busy-wait loops lets SIM_SPIN_CYCLES go by, so a second of clock time is a few
+ hundred host calls while the display is off.
+
+ Only what the firmware uses is there: Timer0/1/2 in normal and CTC modes, ports
+ B/C/D with pin change interrupts, USART0 (async, no frame errors), the EEPROM,
+ sleep and SREG.  Writing a flag register (or PINx) the value it already holds is not seen.
+ An access to UDR0 that leaves it unchanged is taken for a read while RXC0 is set
+ and for a write otherwise.
+
+ The board: the four digits, colon and AM/PM dot are decoded from the common and
+ segment pins after every interrupt, with the polarity of the board header.  Lit segments are collected in DISPLAY_WINDOW
+ pieces and a frame is printed once two pieces in a row agree, so multiplexing,
+ blanking and partly built frames don't show up.  Buzzer pin toggles are printed
+ as "buzzer on" and "buzzer off <ms> <beeps>", a beep ending at a gap of BEEP_GAP.
+ What the firmware sends on the serial port is printed a line at a time as 
+ serial "<text>".  Buttons, the alarm switch and serial input are driven from a 
+ script.
+
+ Fast mode (-f) is for long runs.  The multiplex interrupts (Timer2) are what
+ make a real time second expensive, so in fast mode they are held off except
+ for a while after script input, main loop port writes, buzzer toggles and
+ hal_spin(), while a button is held (the firmware debounces and times the 
+ buttons off Timer2), for as long as hal_frames() asks, and for a short look at
+ the display every probe period (none with -q, nothing would be printed).  Time,
+ alarm and snooze keep running off Timer1 as usual.  A year takes about a minute.
+
+ The EEPROM starts erased, or with the contents of the -e file, which is written
+ back at the end, so a second run sees what the first one stored.
+
+ Usage: clockit-host [-f] [-q] [-C] [-p period] [-t duration] [-e eeprom] [-s script]
+ The script format is in host/script.h.
+*/
+
+#define HOST_SIM
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <time.h>
+#include <avr/io.h>
+#include "board.h"
+#include "script.h"
+
+#define F_SIM               BOARD_F_CPU
+#define MS(x)               SCRIPT_MS(x)
+#define NEVER               SCRIPT_NEVER
+
+#define SIM_ACCESS_CYCLES   2   //Cost of a register access
+#define SIM_ISR_CYCLES      20  //Interrupt entry, register saves and RETI
+#define SIM_SPIN_CYCLES     16  //One pass of a busy-wait loop
+
+#define DISPLAY_WINDOW      MS(5)   //Lit segments are collected this long
+#define DISPLAY_MIN_ISRS    8       //Timer2 interrupts needed for a window to count
+#define BEEP_GAP            MS(20)  //Quiet this long ends a beep
+#define BUZZ_QUIET          MS(500) //Quiet this long ends "buzzer on"
+
+#define FAST_INPUT          MS(200) //Multiplex time after input or a main loop port write
+#define FAST_BUZZ           MS(1000) //after a buzzer toggle
+#define FAST_SPIN           MS(1)   //after hal_spin()
+#define FAST_PROBE          MS(15)  //every probe period
+
+#define EEPROM_SIZE         1024
+#define EEPROM_ERASE_WRITE  (F_SIM * 34 / 10000)    //3.4ms
+#define EEPROM_ERASE_ONLY   (F_SIM * 18 / 10000)    //1.8ms, the same for write only
+
+//Interrupt vectors, by number (= priority)
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#define VEC_PCINT0          3
+#define VEC_PCINT1          4
+#define VEC_PCINT2          5
+#define VEC_WDT             6
+#define VEC_TIMER2_COMPA    7
+#define VEC_TIMER2_COMPB    8
+#define VEC_TIMER2_OVF      9
+#define VEC_TIMER1_CAPT     10
+#define VEC_TIMER1_COMPA    11
+#define VEC_TIMER1_COMPB    12
+#define VEC_TIMER1_OVF      13
+#define VEC_TIMER0_COMPA    14
+#define VEC_TIMER0_COMPB    15
+#define VEC_TIMER0_OVF      16
+#define VEC_USART_RX        18
+#define VEC_USART_UDRE      19
+#define VEC_USART_TX        20
+#define VEC_EE_READY        22
+#define VEC_COUNT           26
+
+//The firmware's ISRs.  A vector the firmware doesn't have stays NULL.
+void host_vect_pcint0(void) __attribute__((weak));
+void host_vect_pcint1(void) __attribute__((weak));
+void host_vect_pcint2(void) __attribute__((weak));
+void host_vect_wdt(void) __attribute__((weak));
+void host_vect_timer2_compa(void) __attribute__((weak));
+void host_vect_timer2_compb(void) __attribute__((weak));
+void host_vect_timer2_ovf(void) __attribute__((weak));
+void host_vect_timer1_capt(void) __attribute__((weak));
+void host_vect_timer1_compa(void) __attribute__((weak));
+void host_vect_timer1_compb(void) __attribute__((weak));
+void host_vect_timer1_ovf(void) __attribute__((weak));
+void host_vect_timer0_compa(void) __attribute__((weak));
+void host_vect_timer0_compb(void) __attribute__((weak));
+void host_vect_timer0_ovf(void) __attribute__((weak));
+void host_vect_usart_rx(void) __attribute__((weak));
+void host_vect_usart_udre(void) __attribute__((weak));
+void host_vect_usart_tx(void) __attribute__((weak));
+void host_vect_ee_ready(void) __attribute__((weak));
+
+int clockit_main(void); //The firmware's main(), renamed by the Makefile
+
+//Declare functions
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+volatile uint8_t *host_reg8(uint8_t addr);
+volatile uint16_t *host_reg16(uint8_t addr);
+void host_sleep_cpu(void);
+void host_spin(void);
+void host_frames(uint16_t ms);
+
+static void sim_sync(uint8_t addr, uint8_t width);
+static void sim_written(uint8_t addr);
+static void sim_udr(void);
+static void sim_flush_last(void);
+static void sim_service(void);
+static void sim_update(void);
+static void sim_schedule(void);
+static void sim_finish(void);
+static void sim_fatal(const char *msg);
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//Chip state
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+volatile uint8_t host_io[0x100] __attribute__((aligned(2))); //Data space 0x00-0xFF, what the firmware sees
+static uint8_t io_shadow[0x100]; //What the simulator last put there
+
+static uint64_t cycles; //Virtual time in CPU clocks since power up
+static uint64_t next_due = 0; //sim_update() has something to do at this cycle
+static uint8_t last_addr, last_width; //Register accessed just before, 0 = none
+static uint8_t in_isr;
+static uint64_t isr_count;
+
+typedef struct
+{
+    const char *name;
+    uint8_t tccra, tccrb, tcnt, ocra, ocrb, icr, timsk, tifr; //Registers, icr = 0 if none
+    uint8_t wide; //16-bit
+    uint8_t vec_capt, vec_compa, vec_compb, vec_ovf;
+    const uint16_t *prescale; //CSn2:0 to clock divider, 0 = stopped
+    uint16_t div; //Cached settings, only reloaded when the firmware writes them
+    uint8_t wgm;
+    uint16_t top, max, ocra_v, ocrb_v, icr_v;
+    uint16_t count; //TCNTn at timer tick 'tick'
+    uint64_t tick; //cycles / div when count was last brought up to date
+    uint8_t flags; //TIFRn
+} sim_timer_t;
+
+static const uint16_t prescale_01[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 }; //External clock not simulated
+static const uint16_t prescale_2[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+
+static sim_timer_t timer[3] =
+{
+    { "Timer0", TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, 0, TIMSK0, TIFR0, 0,
+      0, VEC_TIMER0_COMPA, VEC_TIMER0_COMPB, VEC_TIMER0_OVF, prescale_01 },
+    { "Timer1", TCCR1A, TCCR1B, TCNT1, OCR1A, OCR1B, ICR1, TIMSK1, TIFR1, 1,
+      VEC_TIMER1_CAPT, VEC_TIMER1_COMPA, VEC_TIMER1_COMPB, VEC_TIMER1_OVF, prescale_01 },
+    { "Timer2", TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, 0, TIMSK2, TIFR2, 0,
+      0, VEC_TIMER2_COMPA, VEC_TIMER2_COMPB, VEC_TIMER2_OVF, prescale_2 },
+};
+
+//Ports B, C, D (BOARD_PORT_*): PINx, DDRx, PORTx are 3 apart
+#define PIN_ADDR(p)     (PINB + 3 * (p))
+#define DDR_ADDR(p)     (DDRB + 3 * (p))
+#define PORT_ADDR(p)    (PORTB + 3 * (p))
+
+static uint8_t pin_level[3]; //Last published PINx
+static uint8_t pin_pulled_low[3]; //Inputs held low from outside (buttons)
+static uint8_t pin_driven_high[3]; //Inputs held high from outside (alarm switch on)
+
+static uint8_t usart_flags = (1<<UDRE0); //UCSR0A: RXC0, TXC0, UDRE0, DOR0
+static uint8_t usart_rx_data; //Received byte, what a read of UDR0 gives
+static int usart_tx_shift = -1, usart_tx_next = -1; //Byte being sent and the one waiting in UDR0, -1 none
+static uint64_t usart_tx_done = NEVER; //Shift register empty at
+static char *usart_rx_text; //Script input still to come in
+static size_t usart_rx_len, usart_rx_pos;
+static uint64_t usart_rx_at = NEVER; //Next byte in
+
+static uint8_t eeprom[EEPROM_SIZE];
+static uint64_t eeprom_done = NEVER; //EEPE clears at
+static uint64_t eeprom_writes;
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//What is recorded
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+typedef struct
+{
+    uint8_t digit[4]; //Segments A-G, DP of DIG1-4
+    uint8_t colon, ampm;
+} sim_frame_t;
+
+static sim_frame_t frame_now, frame_prev, frame_shown;
+static uint64_t frame_window, frame_prev_window; //Window number (cycles / DISPLAY_WINDOW)
+static uint32_t frame_isrs; //Timer2 interrupts in this window
+static uint8_t frame_prev_valid, frame_shown_valid;
+
+static uint8_t buzz_on;
+static uint64_t buzz_start, buzz_last;
+static uint32_t buzz_beeps;
+
+static char serial_line[128]; //Sent by the firmware, printed at the newline
+static unsigned serial_len;
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//Options and script
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+static uint8_t opt_fast, opt_quiet, opt_colon;
+static const char *opt_eeprom;
+static uint64_t opt_probe = MS(60000);
+static uint64_t end_cycle = NEVER;
+
+static uint64_t t2_open_until = NEVER; //Fast mode: Timer2 interrupts taken until here
+static uint64_t next_probe = NEVER;
+
+static unsigned script_next; //Next event of the script
+
+static clock_t wall_start;
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+static void print_time(FILE *f, uint64_t at)
+{
+    uint64_t ms = at / MS(1);
+
+    fprintf(f, "%3llud %02u:%02u:%02u.%03u ", (unsigned long long)(ms / 86400000),
+        (unsigned)(ms / 3600000 % 24), (unsigned)(ms / 60000 % 60), (unsigned)(ms / 1000 % 60), (unsigned)(ms % 1000));
+}
+
+static void sim_fatal(const char *msg)
+{
+    fflush(stdout);
+    print_time(stderr, cycles);
+    fprintf(stderr, "sim: %s\n", msg);
+    exit(2);
+}
+
+//Put a value in a register without it looking like a firmware write
+static void io_set(uint8_t addr, uint8_t v)
+{
+    host_io[addr] = v;
+    io_shadow[addr] = v;
+}
+
+//Timers
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+static uint16_t io_get16(uint8_t addr)
+{
+    return(host_io[addr] | (host_io[addr + 1] << 8));
+}
+
+static void io_set16(uint8_t addr, uint16_t v)
+{
+    io_set(addr, v & 0xFF);
+    io_set(addr + 1, v >> 8);
+}
+
+//Timer ticks from count to the next time it is v, 0 if never
+static uint32_t timer_ticks_to(const sim_timer_t *t, uint16_t v)
+{
+    uint32_t period = (uint32_t)t->top + 1;
+
+    if(t->count > t->top) //Runs up to MAX first, then wraps to 0
+    {
+        if(v > t->count) return(v - t->count);
+        if(v > t->top) return(0);
+        return((uint32_t)t->max - t->count + 1 + v);
+    }
+
+    if(v > t->top) return(0);
+    return((v + period - t->count - 1) % period + 1);
+}
+
+//Ticks to each flag source, 0 = never
+static void timer_sources(const sim_timer_t *t, uint32_t *capt, uint32_t *compa, uint32_t *compb, uint32_t *ovf)
+{
+    *capt = (t->wgm == 12) ? timer_ticks_to(t, t->icr_v) : 0;
+    *compa = timer_ticks_to(t, t->ocra_v);
+    *compb = timer_ticks_to(t, t->ocrb_v);
+    *ovf = (t->top == t->max || t->count > t->top) ? timer_ticks_to(t, 0) : 0;
+}
+
+//Bring a timer up to the current cycle, setting the flags it went past
+static void timer_advance(sim_timer_t *t)
+{
+    uint64_t n;
+    uint32_t capt, compa, compb, ovf;
+
+    if(t->div == 0) return;
+
+    n = cycles / t->div - t->tick;
+    if(n == 0) return;
+    t->tick += n;
+
+    //A flag is set if its value comes up at least once
+    timer_sources(t, &capt, &compa, &compb, &ovf);
+    if(capt != 0 && capt <= n) t->flags |= (1<<ICF1);
+    if(compa != 0 && compa <= n) t->flags |= (1<<OCF1A); //Same bits in TIFR0/1/2
+    if(compb != 0 && compb <= n) t->flags |= (1<<OCF1B);
+    if(ovf != 0 && ovf <= n) t->flags |= (1<<TOV1);
+
+    if(t->count > t->top) //Past TOP (TOP was lowered), runs up to MAX and wraps first
+    {
+        uint32_t k = (uint32_t)t->max - t->count + 1;
+
+        if(n < k)
+        {
+            t->count += n;
+            n = 0;
+        }
+        else
+        {
+            n -= k;
+            t->count = 0;
+        }
+    }
+    t->count = (uint16_t)((t->count + n) % ((uint32_t)t->top + 1));
+
+    io_set(t->tifr, t->flags);
+}
+
+//Cycle the next enabled interrupt of a timer is due, NEVER if none
+static uint64_t timer_next(const sim_timer_t *t)
+{
+    uint32_t ticks[4], best = 0;
+    uint8_t mask = host_io[t->timsk];
+
+    if(t->div == 0) return(NEVER);
+
+    timer_sources(t, &ticks[0], &ticks[1], &ticks[2], &ticks[3]);
+    if( (mask & (1<<ICIE1)) == 0) ticks[0] = 0;
+    if( (mask & (1<<OCIE1A)) == 0) ticks[1] = 0;
+    if( (mask & (1<<OCIE1B)) == 0) ticks[2] = 0;
+    if( (mask & (1<<TOIE1)) == 0) ticks[3] = 0;
+
+    for(int i = 0 ; i < 4 ; i++)
+        if(ticks[i] != 0 && (best == 0 || ticks[i] < best)) best = ticks[i];
+
+    if(best == 0) return(NEVER);
+    return((t->tick + best) * t->div);
+}
+
+//Reload the settings after the firmware changed them
+static void timer_config(sim_timer_t *t)
+{
+    uint8_t a = host_io[t->tccra], b = host_io[t->tccrb];
+
+    timer_advance(t); //Up to now with the old settings
+
+    t->wgm = (a & 3) | ((b & (1<<WGM12)) ? 4 : 0) | ((t->wide && (b & (1<<WGM13))) ? 8 : 0);
+    t->max = t->wide ? 0xFFFF : 0xFF;
+    t->ocra_v = t->wide ? io_get16(t->ocra) : host_io[t->ocra];
+    t->ocrb_v = t->wide ? io_get16(t->ocrb) : host_io[t->ocrb];
+    t->icr_v = t->icr ? io_get16(t->icr) : 0;
+
+    if(t->wgm == 0)
+        t->top = t->max; //Normal
+    else if(t->wgm == 2 && !t->wide)
+        t->top = t->ocra_v; //CTC, TOP = OCRnA
+    else if(t->wgm == 4 && t->wide)
+        t->top = t->ocra_v; //CTC, TOP = OCR1A
+    else if(t->wgm == 12 && t->wide)
+        t->top = t->icr_v; //CTC, TOP = ICR1
+    else
+    {
+        char msg[80];
+        snprintf(msg, sizeof(msg), "%s waveform mode %u is not simulated", t->name, t->wgm);
+        sim_fatal(msg);
+    }
+
+    if(t->prescale[b & 7] != t->div)
+    {
+        t->div = t->prescale[b & 7];
+        if(t->div != 0) t->tick = cycles / t->div;
+    }
+}
+
+static sim_timer_t *reg_timer[0x100]; //Timer a register belongs to
+static uint8_t reg_live[0x100]; //TCNTn and TIFRn change on their own
+
+static void timer_init(void)
+{
+    for(int i = 0 ; i < 3 ; i++)
+    {
+        sim_timer_t *t = &timer[i];
+        uint8_t regs[] = { t->tccra, t->tccrb, t->tcnt, t->ocra, t->ocrb, t->icr, t->timsk, t->tifr };
+
+        for(unsigned r = 0 ; r < sizeof(regs) ; r++)
+        {
+            if(regs[r] == 0) continue;
+            reg_timer[regs[r]] = t;
+            if(t->wide && regs[r] != t->tccra && regs[r] != t->tccrb && regs[r] != t->timsk && regs[r] != t->tifr)
+                reg_timer[regs[r] + 1] = t;
+        }
+        reg_live[t->tcnt] = reg_live[t->tifr] = 1;
+        if(t->wide) reg_live[t->tcnt + 1] = 1;
+
+        timer_config(t);
+    }
+}
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//Pins
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+static uint8_t port_level(uint8_t p)
+{
+    uint8_t ddr = host_io[DDR_ADDR(p)], port = host_io[PORT_ADDR(p)];
+    uint8_t in = (port | pin_driven_high[p]) & ~pin_pulled_low[p]; //Pull-ups, buttons, switch
+
+    return((port & ddr) | (in & ~ddr));
+}
+
+static uint8_t pin_high(board_pin_t pin)
+{
+    return( (port_level(pin.port) & pin.mask) != 0 );
+}
+
+static void display_flush(void)
+{
+    static const struct { uint8_t seg; char c; } font[] =
+    {
+        {0x3F, '0'}, {0x06, '1'}, {0x5B, '2'}, {0x4F, '3'}, {0x66, '4'}, {0x6D, '5'}, {0x7D, '6'}, {0x07, '7'},
+        {0x7F, '8'}, {0x6F, '9'}, {0x77, 'A'}, {0x7C, 'b'}, {0x39, 'C'}, {0x58, 'c'}, {0x5E, 'd'}, {0x79, 'E'},
+        {0x71, 'F'}, {0x76, 'H'}, {0x74, 'h'}, {0x38, 'L'}, {0x54, 'n'}, {0x5C, 'o'}, {0x73, 'P'}, {0x50, 'r'},
+        {0x78, 't'}, {0x3E, 'U'}, {0x1C, 'u'}, {0x6E, 'y'}, {0x40, '-'}, {0x08, '_'}, {0x00, ' '},
+    };
+    char text[6];
+    sim_frame_t f = frame_now;
+
+    if(opt_colon) f.colon = 1;
+
+    if(frame_isrs >= DISPLAY_MIN_ISRS)
+    {
+        if(frame_prev_valid && frame_prev_window + 1 == frame_window && memcmp(&f, &frame_prev, sizeof(f)) == 0 &&
+           (!frame_shown_valid || memcmp(&f, &frame_shown, sizeof(f)) != 0))
+        {
+            for(int d = 0 ; d < 4 ; d++)
+            {
+                text[d + (d >= 2)] = '?';
+                for(unsigned i = 0 ; i < sizeof(font) / sizeof(font[0]) ; i++)
+                    if(font[i].seg == (f.digit[d] & 0x7F)) text[d + (d >= 2)] = font[i].c;
+            }
+            text[2] = f.colon ? ':' : ' ';
+            text[5] = 0;
+
+            if(!opt_quiet)
+            {
+                print_time(stdout, frame_prev_window * DISPLAY_WINDOW);
+                printf("display \"%s\"%s", text, f.ampm ? " apos" : "");
+                for(int d = 0 ; d < 4 ; d++)
+                    if(f.digit[d] & 0x80) printf(d == 3 ? " dp" : " dp%d", d + 1);
+                printf("\n");
+            }
+
+            frame_shown = f;
+            frame_shown_valid = 1;
+        }
+
+        frame_prev = f;
+        frame_prev_window = frame_window;
+        frame_prev_valid = 1;
+    }
+    else
+        frame_prev_valid = 0;
+
+    memset(&frame_now, 0, sizeof(frame_now));
+    frame_isrs = 0;
+}
+
+//Collect what is lit right now
+static void display_sample(uint8_t vec)
+{
+    uint8_t segs = 0;
+    uint64_t w = cycles / DISPLAY_WINDOW;
+
+    if(w != frame_window)
+    {
+        display_flush();
+        frame_window = w;
+    }
+
+    if(vec == VEC_TIMER2_COMPA || vec == VEC_TIMER2_COMPB || vec == VEC_TIMER2_OVF) frame_isrs++;
+
+    for(int s = 0 ; s < 8 ; s++)
+        if(pin_high(board_segment[s]) != BOARD_COMMON_ANODE) segs |= (1<<s);
+
+    for(int a = 0 ; a < 4 ; a++)
+        if(pin_high(board_common[a]) == BOARD_COMMON_ANODE) frame_now.digit[a] |= segs;
+
+    if(pin_high(board_common[BOARD_COMMON_COL]) == BOARD_COMMON_ANODE && pin_high(board_seg_col) != BOARD_COMMON_ANODE)
+        frame_now.colon = 1;
+    if(pin_high(board_common[BOARD_COMMON_AMPM]) == BOARD_COMMON_ANODE && pin_high(board_seg_ampm) != BOARD_COMMON_ANODE)
+        frame_now.ampm = 1;
+}
+
+static void buzzer_toggled(void)
+{
+    if(!buzz_on)
+    {
+        buzz_on = 1;
+        buzz_start = cycles;
+        buzz_beeps = 1;
+        print_time(stdout, cycles);
+        printf("buzzer on\n");
+    }
+    else if(cycles - buzz_last >= BEEP_GAP)
+        buzz_beeps++;
+
+    buzz_last = cycles;
+    if(opt_fast && t2_open_until < cycles + FAST_BUZZ) t2_open_until = cycles + FAST_BUZZ;
+    sim_schedule();
+}
+
+static void buzzer_check(void)
+{
+    if(buzz_on && cycles - buzz_last >= BUZZ_QUIET)
+    {
+        buzz_on = 0;
+        print_time(stdout, buzz_last);
+        printf("buzzer off %llums %u beep%s\n", (unsigned long long)((buzz_last - buzz_start) / MS(1)),
+            buzz_beeps, buzz_beeps == 1 ? "" : "s");
+    }
+}
+
+//The alarm slide switch pulls its pin high when on, to ground when off
+static void alarm_switch(uint8_t on)
+{
+    uint8_t bit = board_alarm.mask;
+
+    if(on)
+    {
+        pin_driven_high[board_alarm.port] |= bit;
+        pin_pulled_low[board_alarm.port] &= ~bit;
+    }
+    else
+    {
+        pin_driven_high[board_alarm.port] &= ~bit;
+        pin_pulled_low[board_alarm.port] |= bit;
+    }
+}
+
+//A button is pressed
+static int buttons_down(void)
+{
+    for(int i = 0 ; i < 3 ; i++)
+        if(pin_pulled_low[board_button[i].port] & board_button[i].mask) return(1);
+
+    return(0);
+}
+
+//Something may have changed a pin: publish PINx, raise pin change flags
+static void pins_changed(void)
+{
+    static const uint8_t pcmsk[3] = { PCMSK0, PCMSK1, PCMSK2 }; //Port B, C, D
+    uint8_t flags = host_io[PCIFR];
+
+    for(int p = 0 ; p < 3 ; p++)
+    {
+        uint8_t v = port_level(p);
+
+        if( (v ^ pin_level[p]) & host_io[pcmsk[p]] ) flags |= (1<<p);
+        if(p == BOARD_BUZZ_PORT && ((v ^ pin_level[p]) & BOARD_BUZZ_MASK)) buzzer_toggled();
+
+        pin_level[p] = v;
+        io_set(PIN_ADDR(p), v);
+    }
+
+    io_set(PCIFR, flags & 7);
+}
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//USART0
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+static uint8_t usart_on(uint8_t en)
+{
+    return( (host_io[PRR] & (1<<PRUSART0)) == 0 && (host_io[UCSR0B] & en) != 0 );
+}
+
+//Start, data and stop bits
+static uint64_t usart_byte_cycles(void)
+{
+    uint64_t bit = ((uint64_t)(io_get16(UBRR0) & 0x0FFF) + 1) * ((host_io[UCSR0A] & (1<<U2X0)) ? 8 : 16);
+    uint8_t bits = 1 + 5 + ((host_io[UCSR0C] >> UCSZ00) & 3) + 1 + ((host_io[UCSR0C] & (1<<USBS0)) ? 1 : 0);
+
+    if(host_io[UCSR0C] & (1<<UPM01)) bits++;
+    return(bit * bits);
+}
+
+static void usart_publish(void)
+{
+    io_set(UCSR0A, usart_flags | (host_io[UCSR0A] & ((1<<U2X0)|(1<<MPCM0))));
+    io_set(UDR0, usart_rx_data);
+}
+
+static void serial_out(uint8_t c)
+{
+    if(c == '\n')
+    {
+        serial_line[serial_len] = 0;
+        print_time(stdout, cycles);
+        printf("serial \"%s\"\n", serial_line);
+        serial_len = 0;
+        return;
+    }
+    if(c == '\r') return;
+
+    if(serial_len + 5 < sizeof(serial_line))
+    {
+        if(c >= ' ' && c < 0x7F && c != '"' && c != '\\')
+            serial_line[serial_len++] = c;
+        else
+            serial_len += sprintf(serial_line + serial_len, "\\x%02X", c);
+    }
+}
+
+//The firmware wrote UDR0
+static void usart_write(uint8_t v)
+{
+    if(!usart_on(1<<TXEN0)) return;
+
+    if(usart_tx_shift < 0) //Straight into the shift register
+    {
+        usart_tx_shift = v;
+        usart_tx_done = cycles + usart_byte_cycles();
+    }
+    else
+    {
+        usart_tx_next = v;
+        usart_flags &= ~(1<<UDRE0);
+    }
+    usart_publish();
+}
+
+//Type a line into the serial port
+static void usart_send(const char *text)
+{
+    size_t n = strlen(text);
+
+    usart_rx_text = realloc(usart_rx_text, usart_rx_len + n + 1);
+    if(usart_rx_text == NULL) sim_fatal("out of memory");
+    memcpy(usart_rx_text + usart_rx_len, text, n);
+    usart_rx_len += n;
+    usart_rx_text[usart_rx_len++] = '\n';
+
+    if(usart_rx_at == NEVER) usart_rx_at = cycles;
+}
+
+//Bytes sent and received up to now
+static void usart_update(void)
+{
+    while(usart_tx_done <= cycles)
+    {
+        serial_out(usart_tx_shift);
+
+        if(usart_tx_next >= 0)
+        {
+            usart_tx_shift = usart_tx_next;
+            usart_tx_next = -1;
+            usart_flags |= (1<<UDRE0);
+            usart_tx_done += usart_byte_cycles();
+        }
+        else
+        {
+            usart_tx_shift = -1;
+            usart_tx_done = NEVER;
+            usart_flags |= (1<<TXC0);
+        }
+    }
+
+    while(usart_rx_at <= cycles)
+    {
+        if(usart_on(1<<RXEN0))
+        {
+            if(usart_flags & (1<<RXC0))
+                usart_flags |= (1<<DOR0); //Not read in time, this byte is lost
+            else
+            {
+                usart_rx_data = usart_rx_text[usart_rx_pos];
+                usart_flags |= (1<<RXC0);
+            }
+        }
+
+        if(++usart_rx_pos == usart_rx_len)
+        {
+            usart_rx_pos = usart_rx_len = 0;
+            usart_rx_at = NEVER;
+        }
+        else
+            usart_rx_at += usart_byte_cycles();
+    }
+
+    usart_publish();
+}
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//EEPROM
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//The firmware wrote EECR: a read (EERE), or EEPE with EEMPE already set starts 
+//a write.  The cell changes at once, EEPE stays set for the programming time.
+static void eeprom_control(uint8_t v, uint8_t was)
+{
+    uint16_t addr = io_get16(EEAR) & (EEPROM_SIZE - 1);
+    uint8_t mode = (v >> EEPM0) & 3;
+
+    if(v & (1<<EERE))
+    {
+        if(was & (1<<EEPE)) sim_fatal("EEPROM read while a write is going on");
+        io_set(EEDR, eeprom[addr]);
+        cycles += 4; //The CPU is halted
+        v &= ~(1<<EERE);
+    }
+
+    if( (v & (1<<EEPE)) && !(was & (1<<EEPE)) )
+    {
+        if( (was & (1<<EEMPE)) == 0 )
+            v &= ~(1<<EEPE); //EEMPE wasn't set first, nothing happens
+        else
+        {
+            if(mode == 0 || mode == 1) eeprom[addr] = 0xFF; //Erase
+            if(mode == 0 || mode == 2) eeprom[addr] &= host_io[EEDR]; //Write
+            eeprom_done = cycles + (mode == 0 ? EEPROM_ERASE_WRITE : EEPROM_ERASE_ONLY);
+            eeprom_writes++;
+        }
+        v &= ~(1<<EEMPE);
+    }
+    if(was & (1<<EEPE)) v |= (1<<EEPE); //Can't be cleared by the firmware
+
+    io_set(EECR, v);
+    next_due = cycles; //EERIE may have been set
+}
+
+static void eeprom_update(void)
+{
+    if(eeprom_done <= cycles)
+    {
+        eeprom_done = NEVER;
+        io_set(EECR, host_io[EECR] & ~(1<<EEPE));
+    }
+}
+
+static void eeprom_load(void)
+{
+    FILE *f;
+
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    if(opt_eeprom == NULL || (f = fopen(opt_eeprom, "rb")) == NULL) return; //Erased
+    if(fread(eeprom, 1, sizeof(eeprom), f) != sizeof(eeprom)) sim_fatal("EEPROM file is too short");
+    fclose(f);
+}
+
+static void eeprom_save(void)
+{
+    FILE *f;
+
+    if(opt_eeprom == NULL) return;
+    if( (f = fopen(opt_eeprom, "wb")) == NULL || fwrite(eeprom, 1, sizeof(eeprom), f) != sizeof(eeprom) )
+    {
+        perror(opt_eeprom);
+        exit(2);
+    }
+    fclose(f);
+}
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+//Interrupts
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+static uint8_t t2_open(void)
+{
+    return(!opt_fast || cycles < t2_open_until);
+}
+
+//Highest priority interrupt that is flagged and enabled, 0 if none
+static uint8_t pending(void)
+{
+    uint8_t pc = host_io[PCIFR] & host_io[PCICR];
+
+    if(pc & (1<<PCIF0)) return(VEC_PCINT0);
+    if(pc & (1<<PCIF1)) return(VEC_PCINT1);
+    if(pc & (1<<PCIF2)) return(VEC_PCINT2);
+
+    for(int i = 2 ; i >= 0 ; i--) //Timer2 has the lowest vector numbers
+    {
+        sim_timer_t *t = &timer[i];
+        uint8_t f = t->flags & host_io[t->timsk];
+
+        if(f == 0 || (i == 2 && !t2_open())) continue;
+        if(f & (1<<ICF1)) return(t->vec_capt);
+        if(f & (1<<OCF1A)) return(t->vec_compa);
+        if(f & (1<<OCF1B)) return(t->vec_compb);
+        if(f & (1<<TOV1)) return(t->vec_ovf);
+    }
+
+    if(usart_flags & host_io[UCSR0B] & (1<<RXCIE0)) return(VEC_USART_RX); //Flags and enables share bits
+    if(usart_flags & host_io[UCSR0B] & (1<<UDRIE0)) return(VEC_USART_UDRE);
+    if(usart_flags & host_io[UCSR0B] & (1<<TXCIE0)) return(VEC_USART_TX);
+    if( (host_io[EECR] & ((1<<EERIE)|(1<<EEPE))) == (1<<EERIE) ) return(VEC_EE_READY);
+
+    return(0);
+}
+
+static void dispatch(uint8_t vec)
+{
+    static void (* const vector[VEC_COUNT])(void) =
+    {
+        [VEC_PCINT0] = host_vect_pcint0, [VEC_PCINT1] = host_vect_pcint1, [VEC_PCINT2] = host_vect_pcint2,
+        [VEC_WDT] = host_vect_wdt,
+        [VEC_TIMER2_COMPA] = host_vect_timer2_compa, [VEC_TIMER2_COMPB] = host_vect_timer2_compb,
+        [VEC_TIMER2_OVF] = host_vect_timer2_ovf,
+        [VEC_TIMER1_CAPT] = host_vect_timer1_capt, [VEC_TIMER1_COMPA] = host_vect_timer1_compa,
+        [VEC_TIMER1_COMPB] = host_vect_timer1_compb, [VEC_TIMER1_OVF] = host_vect_timer1_ovf,
+        [VEC_TIMER0_COMPA] = host_vect_timer0_compa, [VEC_TIMER0_COMPB] = host_vect_timer0_compb,
+        [VEC_TIMER0_OVF] = host_vect_timer0_ovf,
+        [VEC_USART_RX] = host_vect_usart_rx, [VEC_USART_UDRE] = host_vect_usart_udre,
+        [VEC_USART_TX] = host_vect_usart_tx, [VEC_EE_READY] = host_vect_ee_ready,
+    };
+
+    //Taking the vector clears its flag
+    if(vec >= VEC_PCINT0 && vec <= VEC_PCINT2)
+        io_set(PCIFR, host_io[PCIFR] & ~(1 << (vec - VEC_PCINT0)));
+    for(int i = 0 ; i < 3 ; i++)
+    {
+        sim_timer_t *t = &timer[i];
+        if(vec == t->vec_capt) t->flags &= ~(1<<ICF1);
+        if(vec == t->vec_compa) t->flags &= ~(1<<OCF1A);
+        if(vec == t->vec_compb) t->flags &= ~(1<<OCF1B);
+        if(vec == t->vec_ovf) t->flags &= ~(1<<TOV1);
+        io_set(t->tifr, t->flags);
+    }
+    if(vec == VEC_USART_TX)
+    {
+        usart_flags &= ~(1<<TXC0);
+        usart_publish();
+    }
+
+    if(vector[vec] == NULL)
+    {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "interrupt %u has no ISR (the chip would reset)", vec);
+        sim_fatal(msg);
+    }
+
+    io_set(SREG, host_io[SREG] & ~(1<<SREG_I));
+    cycles += SIM_ISR_CYCLES / 2;
+    in_isr++;
+    isr_count++;
+
+    vector[vec]();
+
+    sim_flush_last(); //The ISR's last access
+    in_isr--;
+    cycles += SIM_ISR_CYCLES / 2;
+    io_set(SREG, host_io[SREG] | (1<<SREG_I)); //RETI
+
+    display_sample(vec);
+}
+
+//Bring everything up to the current cycle
+static void sim_update(void)
+{
+    for(int i = 0 ; i < 3 ; i++) timer_advance(&timer[i]);
+    usart_update();
+    eeprom_update();
+
+    while(script_next < script_len && script[script_next].at <= cycles)
+    {
+        script_event_t *e = &script[script_next++];
+
+        if(e->what == SCRIPT_PRESS || e->what == SCRIPT_RELEASE)
+        {
+            board_pin_t pin = board_button[e->arg];
+            if(e->what == SCRIPT_PRESS)
+                pin_pulled_low[pin.port] |= pin.mask;
+            else
+                pin_pulled_low[pin.port] &= ~pin.mask;
+        }
+        else if(e->what == SCRIPT_ALARM)
+            alarm_switch(e->arg);
+        else if(e->what == SCRIPT_SEND)
+            usart_send(e->text);
+        else if(e->what == SCRIPT_ECHO)
+        {
+            print_time(stdout, e->at);
+            printf("%s\n", e->text);
+        }
+        else if(e->what == SCRIPT_END)
+            end_cycle = e->at;
+
+        if(opt_fast && t2_open_until < cycles + FAST_INPUT) t2_open_until = cycles + FAST_INPUT;
+        pins_changed();
+    }
+
+    if(opt_fast && buttons_down() && t2_open_until < cycles + FAST_INPUT)
+        t2_open_until = cycles + FAST_INPUT; //Held buttons are timed by the multiplex interrupt
+
+    if(cycles >= next_probe)
+    {
+        if(t2_open_until < cycles + FAST_PROBE) t2_open_until = cycles + FAST_PROBE;
+        next_probe += opt_probe;
+    }
+
+    buzzer_check();
+
+    if(cycles >= end_cycle) sim_finish();
+
+    sim_schedule();
+}
+
+//Work out when sim_update() is needed next
+static void sim_schedule(void)
+{
+    uint64_t due = end_cycle, t;
+
+    for(int i = 0 ; i < 3 ; i++)
+    {
+        t = timer_next(&timer[i]);
+        if(i == 2 && opt_fast && t >= t2_open_until) continue; //Held off, taken when the window opens
+        if(t < due) due = t;
+    }
+
+    if(script_next < script_len && script[script_next].at < due) due = script[script_next].at;
+    if(next_probe < due) due = next_probe;
+    if(buzz_on && buzz_last + BUZZ_QUIET < due) due = buzz_last + BUZZ_QUIET;
+    if(usart_tx_done < due) due = usart_tx_done;
+    if(usart_rx_at < due) due = usart_rx_at;
+    if(eeprom_done < due) due = eeprom_done;
+
+    next_due = due;
+}
+
+//Update, then take interrupts until none is pending
+static void sim_service(void)
+{
+    uint8_t vec;
+
+    sim_update();
+
+    if(in_isr) return;
+
+    while( (host_io[SREG] & (1<<SREG_I)) && (vec = pending()) != 0 )
+    {
+        dispatch(vec);
+        sim_update();
+    }
+}
+
+//Look at the register accessed just before
+static void sim_flush_last(void)
+{
+    if(last_addr == 0) return;
+
+    sim_written(last_addr);
+    if(last_width == 2) sim_written(last_addr + 1);
+    last_addr = 0;
+}
+
+//The firmware wrote (or only read) addr since the last access
+static void sim_written(uint8_t addr)
+{
+    uint8_t v = host_io[addr];
+    sim_timer_t *t;
+
+    if(addr == UDR0)
+    {
+        sim_udr();
+        return;
+    }
+
+    if(v == io_shadow[addr]) return; //Read only, or wrote the same value
+
+    if(addr >= PINB && addr <= PORTD)
+    {
+        uint8_t p = (addr - PINB) / 3;
+
+        if(addr == PIN_ADDR(p)) //Writing PINx toggles PORTx
+        {
+            io_set(PORT_ADDR(p), host_io[PORT_ADDR(p)] ^ v);
+            io_set(addr, io_shadow[addr]);
+        }
+        io_shadow[addr] = host_io[addr];
+
+        if(opt_fast && !in_isr && t2_open_until < cycles + FAST_INPUT) t2_open_until = cycles + FAST_INPUT;
+        pins_changed();
+        if(!in_isr) display_sample(0);
+        sim_schedule();
+        return;
+    }
+
+    if(addr == PCIFR)
+    {
+        io_set(PCIFR, io_shadow[PCIFR] & ~v); //Write 1 to clear
+        return;
+    }
+
+    if(addr == EECR)
+    {
+        eeprom_control(v, io_shadow[EECR]);
+        return;
+    }
+
+    if(addr == UCSR0A)
+    {
+        if(v & (1<<TXC0)) usart_flags &= ~(1<<TXC0); //Write 1 to clear
+        io_shadow[addr] = v;
+        usart_publish();
+        next_due = cycles;
+        return;
+    }
+
+    if( (t = reg_timer[addr]) != NULL )
+    {
+        if(addr == t->tifr)
+        {
+            timer_advance(t);
+            t->flags &= ~v; //Write 1 to clear
+            io_set(addr, t->flags);
+        }
+        else if(addr == t->tcnt || (t->wide && addr == t->tcnt + 1))
+        {
+            timer_advance(t);
+            t->count = t->wide ? io_get16(t->tcnt) : host_io[t->tcnt];
+            io_shadow[addr] = v;
+        }
+        else
+        {
+            io_shadow[addr] = v;
+            if(t->wide && addr != t->tccra && addr != t->tccrb && addr != t->timsk && (addr & 1) == 0)
+                io_shadow[addr + 1] = host_io[addr + 1];
+            timer_config(t);
+        }
+        sim_schedule();
+        return;
+    }
+
+    io_shadow[addr] = v; //SREG, PCICR, SMCR, ...
+
+    //Interrupts enabled or unmasked, take what is pending at the next access
+    if( (addr == SREG && (v & (1<<SREG_I)) && pending()) || addr == PCICR || addr == PCMSK0 || addr == PCMSK1 || addr == PCMSK2 ||
+        addr == UCSR0B )
+        next_due = cycles;
+}
+
+//The firmware read or wrote UDR0
+static void sim_udr(void)
+{
+    uint8_t v = host_io[UDR0];
+
+    if(v == io_shadow[UDR0] && (usart_flags & (1<<RXC0))) //Read
+    {
+        usart_flags &= ~((1<<RXC0)|(1<<DOR0));
+        usart_publish();
+    }
+    else
+        usart_write(v);
+
+    sim_schedule();
+}
+
+//Every register access of the firmware comes through here
+static void sim_sync(uint8_t addr, uint8_t width)
+{
+    sim_timer_t *t;
+
+    sim_flush_last();
+
+    cycles += SIM_ACCESS_CYCLES;
+    if(cycles >= next_due) sim_service();
+
+    //Registers that change on their own
+    if(reg_live[addr])
+    {
+        t = reg_timer[addr];
+        timer_advance(t);
+        if(t->wide) io_set16(t->tcnt, t->count); else io_set(t->tcnt, (uint8_t)t->count);
+    }
+
+    last_addr = addr;
+    last_width = width;
+}
+
+volatile uint8_t *host_reg8(uint8_t addr)
+{
+    sim_sync(addr, 1);
+    return(&host_io[addr]);
+}
+
+volatile uint16_t *host_reg16(uint8_t addr)
+{
+    sim_sync(addr, 2);
+    return((volatile uint16_t *)&host_io[addr]);
+}
+
+//Main times something off the multiplex interrupt (Timer2) for the next ms
+void host_frames(uint16_t ms)
+{
+    if(opt_fast && t2_open_until < cycles + MS(ms) + FAST_SPIN)
+    {
+        t2_open_until = cycles + MS(ms) + FAST_SPIN;
+        sim_schedule();
+    }
+}
+
+//Body of a busy-wait loop
+void host_spin(void)
+{
+    if(opt_fast && t2_open_until < cycles + FAST_SPIN)
+    {
+        t2_open_until = cycles + FAST_SPIN;
+        sim_schedule();
+    }
+
+    cycles += SIM_SPIN_CYCLES;
+    sim_sync(0, 0);
+}
+
+//SLEEP: run the clock to the next interrupt
+void host_sleep_cpu(void)
+{
+    uint8_t vec;
+
+    sim_sync(0, 0);
+    if( (host_io[SMCR] & (1<<SE)) == 0 ) return; //SLEEP without SE does nothing
+
+    while(1)
+    {
+        sim_update();
+
+        if( (vec = pending()) != 0 )
+        {
+            if(host_io[SREG] & (1<<SREG_I)) sim_service();
+            return; //Woken up
+        }
+
+        if(next_due == NEVER) sim_fatal("asleep with no interrupt coming");
+        if(next_due > cycles) cycles = next_due;
+    }
+}
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+static void sim_finish(void)
+{
+    double wall = (double)(clock() - wall_start) / CLOCKS_PER_SEC;
+    double sim = (double)cycles / F_SIM;
+
+    display_flush();
+    cycles += BUZZ_QUIET; //Report a buzzer still going
+    buzzer_check();
+    cycles -= BUZZ_QUIET;
+
+    fflush(stdout);
+    print_time(stderr, cycles);
+    fprintf(stderr, "sim: done, %.0fs of clock time in %.2fs (%.0fx), %llu interrupts, %llu EEPROM writes\n",
+        sim, wall, wall > 0 ? sim / wall : 0.0, (unsigned long long)isr_count, (unsigned long long)eeprom_writes);
+    eeprom_save();
+    exit(0);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: clockit-host [-f] [-q] [-C] [-p period] [-t duration] [-e eeprom] [-s script]\n"
+        "  -s script    button and switch events, see host/script.h\n"
+        "  -e eeprom    EEPROM contents, read at power up (erased if missing) and written at the end\n"
+        "  -t duration  stop after this much clock time (default 60s, or the script's end)\n"
+        "  -f           fast: multiplex only after input and for a look every probe period\n"
+        "  -p period    fast mode probe period (default 60s, no probes with -q)\n"
+        "  -q           don't print display frames\n"
+        "  -C           ignore the blinking colon\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    uint64_t duration = NEVER;
+
+    while( (c = getopt(argc, argv, "s:t:p:e:fqC")) != -1 )
+    {
+        switch(c)
+        {
+            case 's': script_load(optarg); break;
+            case 't': if( (duration = script_time(optarg)) == NEVER ) usage(); break;
+            case 'p': if( (opt_probe = script_time(optarg)) == NEVER || opt_probe == 0 ) usage(); break;
+            case 'f': opt_fast = 1; break;
+            case 'q': opt_quiet = 1; break;
+            case 'C': opt_colon = 1; break;
+            case 'e': opt_eeprom = optarg; break;
+            default: usage();
+        }
+    }
+    if(optind != argc) usage();
+
+    end_cycle = script_end();
+    if(duration != NEVER) end_cycle = duration;
+    if(end_cycle == NEVER) end_cycle = MS(60000);
+
+    if(opt_fast)
+    {
+        t2_open_until = 0;
+        if(!opt_quiet) next_probe = opt_probe / 2; //Look mid-period, away from the minute changes
+    }
+
+    //Reset values: all inputs, no pull-ups, timers stopped.  Alarm switch off.
+    timer_init();
+    eeprom_load();
+    alarm_switch(0);
+    pins_changed();
+    io_set(PCIFR, 0);
+
+    wall_start = clock();
+    clockit_main();
+
+    sim_fatal("main() returned");
+    return(2);
+}